@@ -0,0 +1,354 @@
+#include "dmlinq.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#if defined(_MSC_VER)
+#pragma comment(lib, "psapi.lib")
+#endif
+#else
+#include <sys/resource.h>
+#endif
+
+// dmlinqbench: micro benchmarks for the dmlinq operators.
+//
+//   dmlinqbench [--json] [--filter <substring>] [--max-size <n>] [--min-time <seconds>]
+//
+// Every benchmark runs each (operator, element type, size) combination until --min-time has
+// elapsed and reports ns per element, heap bytes/allocations per iteration and the process
+// peak RSS. Sizes grow by 10x from 1K up to --max-size (default 1M, at most 100M). Inputs are
+// only generated for element types with a case that passes --filter, one type at a time, and each
+// query is built once outside the timed loop so the per-iteration figures exclude copying the
+// input into the query's source.
+
+// ---------------------------------------------------------------------------
+// Allocation accounting
+// ---------------------------------------------------------------------------
+static std::atomic<size_t> g_bytes_allocated{ 0 };
+static std::atomic<size_t> g_allocations{ 0 };
+
+static void* benchAllocate(std::size_t size) {
+    g_bytes_allocated.fetch_add(size, std::memory_order_relaxed);
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) { return p; }
+    throw std::bad_alloc();
+}
+
+// Over-aligned allocations (alignas types, std::align_val_t) must be released with the matching
+// aligned free, so they get their own allocate/free pair.
+static void* benchAllocateAligned(std::size_t size, std::align_val_t alignment) {
+    g_bytes_allocated.fetch_add(size, std::memory_order_relaxed);
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    std::size_t align = (std::max)(static_cast<std::size_t>(alignment), sizeof(void*));
+#if defined(_WIN32)
+    if (void* p = _aligned_malloc(size ? size : 1, align)) { return p; }
+#else
+    void* p = nullptr;
+    if (posix_memalign(&p, align, size ? size : 1) == 0) { return p; }
+#endif
+    throw std::bad_alloc();
+}
+
+static void benchFreeAligned(void* p) {
+#if defined(_WIN32)
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+void* operator new(std::size_t size) { return benchAllocate(size); }
+void* operator new[](std::size_t size) { return benchAllocate(size); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    try { return benchAllocate(size); } catch (...) { return nullptr; }
+}
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    try { return benchAllocate(size); } catch (...) { return nullptr; }
+}
+void* operator new(std::size_t size, std::align_val_t alignment) { return benchAllocateAligned(size, alignment); }
+void* operator new[](std::size_t size, std::align_val_t alignment) { return benchAllocateAligned(size, alignment); }
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    try { return benchAllocateAligned(size, alignment); } catch (...) { return nullptr; }
+}
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    try { return benchAllocateAligned(size, alignment); } catch (...) { return nullptr; }
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { benchFreeAligned(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { benchFreeAligned(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { benchFreeAligned(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { benchFreeAligned(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { benchFreeAligned(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { benchFreeAligned(p); }
+
+static size_t peakRssBytes() {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) { return counters.PeakWorkingSetSize; }
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) { return 0; }
+#if defined(__APPLE__)
+    return static_cast<size_t>(usage.ru_maxrss);
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+// Keeps the optimizer from discarding a benchmark result.
+static volatile uint64_t g_sink = 0;
+template <typename TValue>
+static void consume(const TValue& value) { g_sink = g_sink + static_cast<uint64_t>(value); }
+
+// ---------------------------------------------------------------------------
+// Element types
+// ---------------------------------------------------------------------------
+struct WideRecord {
+    int64_t id;
+    int32_t key;
+    int32_t flags;
+    double payload[14];
+};
+
+inline int64_t keyOf(int value) { return value; }
+inline int64_t keyOf(double value) { return static_cast<int64_t>(value); }
+inline int64_t keyOf(const WideRecord& value) { return value.key; }
+
+inline int64_t idOf(int value) { return value; }
+inline int64_t idOf(double value) { return static_cast<int64_t>(value); }
+inline int64_t idOf(const WideRecord& value) { return value.id; }
+
+template <typename T> T makeElement(size_t index, uint32_t random);
+template <> int makeElement<int>(size_t index, uint32_t random) { (void)index; return static_cast<int>(random % 1000000); }
+template <> double makeElement<double>(size_t index, uint32_t random) { (void)index; return (random % 1000000) * 0.5; }
+template <> WideRecord makeElement<WideRecord>(size_t index, uint32_t random) {
+    WideRecord record{};
+    record.id = static_cast<int64_t>(index);
+    record.key = static_cast<int32_t>(random % 1000000);
+    record.flags = static_cast<int32_t>(random & 0xff);
+    for (size_t i = 0; i < 14; ++i) { record.payload[i] = static_cast<double>(random) * (i + 1); }
+    return record;
+}
+
+template <typename T>
+static std::vector<T> makeInput(size_t size) {
+    std::mt19937 rng(static_cast<uint32_t>(size));
+    std::vector<T> rows;
+    rows.reserve(size);
+    for (size_t i = 0; i < size; ++i) { rows.push_back(makeElement<T>(i, rng())); }
+    // toMap keys on the id, so make ids unique for the scalar types as well.
+    if constexpr (std::is_same_v<T, int>) { for (size_t i = 0; i < size; ++i) { if (i % 2 == 0) rows[i] = static_cast<int>(i); } }
+    return rows;
+}
+
+// ---------------------------------------------------------------------------
+// Harness
+// ---------------------------------------------------------------------------
+struct BenchOptions {
+    bool json = false;
+    std::string filter;
+    size_t max_size = 1000000;
+    double min_time = 0.2;
+};
+
+struct BenchResult {
+    std::string name;
+    std::string type;
+    size_t size = 0;
+    size_t iterations = 0;
+    double ns_per_iteration = 0;
+    double ns_per_element = 0;
+    double bytes_per_iteration = 0;
+    double allocations_per_iteration = 0;
+    size_t peak_rss = 0;
+};
+
+struct BenchCase {
+    std::string name;
+    std::string type;
+    size_t size;
+    std::function<void()> body;
+};
+
+static BenchResult runCase(const BenchCase& bench, const BenchOptions& options) {
+    using Clock = std::chrono::steady_clock;
+    bench.body(); // warm up caches and the allocator
+
+    BenchResult result;
+    result.name = bench.name;
+    result.type = bench.type;
+    result.size = bench.size;
+
+    size_t bytes_before = g_bytes_allocated.load();
+    size_t allocations_before = g_allocations.load();
+    auto start = Clock::now();
+    double elapsed = 0;
+    size_t iterations = 0;
+    do {
+        bench.body();
+        ++iterations;
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < options.min_time);
+
+    double ns = elapsed * 1e9;
+    result.iterations = iterations;
+    result.ns_per_iteration = ns / iterations;
+    result.ns_per_element = bench.size ? result.ns_per_iteration / bench.size : 0;
+    result.bytes_per_iteration = static_cast<double>(g_bytes_allocated.load() - bytes_before) / iterations;
+    result.allocations_per_iteration = static_cast<double>(g_allocations.load() - allocations_before) / iterations;
+    result.peak_rss = peakRssBytes();
+    return result;
+}
+
+static const char* const kOperators[] = { "where", "select", "orderBy", "orderBy.take10", "sum", "toMap", "groupBy" };
+
+static bool selected(const BenchOptions& options, const std::string& name, const char* type, size_t size) {
+    std::string full_name = name + "/" + type + "/" + std::to_string(size);
+    return options.filter.empty() || full_name.find(options.filter) != std::string::npos;
+}
+
+// Queries are reusable, so each case builds its query once: the input is moved into the shared
+// source snapshot and every iteration only runs the operator under test.
+template <typename T>
+static void addCases(std::vector<BenchCase>& cases, const char* type, size_t size, const BenchOptions& options) {
+    bool any = std::any_of(std::begin(kOperators), std::end(kOperators),
+        [&](const char* name) { return selected(options, name, type, size); });
+    if (!any) { return; }
+
+    auto source = dmlinq::from(makeInput<T>(size));
+    auto add = [&](const char* name, std::function<void()> body) {
+        if (selected(options, name, type, size)) { cases.push_back(BenchCase{ name, type, size, std::move(body) }); }
+    };
+
+    add("where", [query = source.where([](const T& v) { return keyOf(v) % 3 == 0; })] {
+        auto rows = query.toVector();
+        consume(rows.size());
+    });
+    add("select", [query = source.select([](const T& v) { return keyOf(v) * 2; })] {
+        auto rows = query.toVector();
+        consume(rows.size());
+    });
+    add("orderBy", [query = source.orderBy([](const T& v) { return keyOf(v); })] {
+        auto rows = query.toVector();
+        consume(rows.size());
+    });
+    add("orderBy.take10", [query = source.orderBy([](const T& v) { return keyOf(v); }).take(10)] {
+        auto rows = query.toVector();
+        consume(rows.size());
+    });
+    add("sum", [source] {
+        consume(source.sum([](const T& v) { return keyOf(v); }));
+    });
+    add("toMap", [source] {
+        auto map = source.toMap([](const T& v) { return idOf(v); });
+        consume(map.size());
+    });
+    add("groupBy", [query = source.groupBy([](const T& v) { return keyOf(v) % 1024; })] {
+        auto groups = query.toVector();
+        consume(groups.size());
+    });
+}
+
+static std::string humanBytes(double bytes) {
+    const char* units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+    size_t unit = 0;
+    while (bytes >= 1024 && unit + 1 < sizeof(units) / sizeof(units[0])) { bytes /= 1024; ++unit; }
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.1f %s", bytes, units[unit]);
+    return buffer;
+}
+
+static void printTableHeader() {
+    std::printf("%-24s%-8s%12s%12s%14s%14s%12s%12s\n",
+        "benchmark", "type", "size", "iters", "ns/iter", "ns/elem", "bytes/iter", "peak rss");
+    std::printf("%s\n", std::string(108, '-').c_str());
+}
+
+static void printTableRow(const BenchResult& r) {
+    std::printf("%-24s%-8s%12zu%12zu%14.0f%14.3f%12s%12s\n",
+        r.name.c_str(), r.type.c_str(), r.size, r.iterations, r.ns_per_iteration, r.ns_per_element,
+        humanBytes(r.bytes_per_iteration).c_str(), humanBytes(static_cast<double>(r.peak_rss)).c_str());
+    std::fflush(stdout);
+}
+
+static void printJson(const std::vector<BenchResult>& results) {
+    std::printf("{\n  \"context\": { \"library\": \"dmlinq\", \"version\": \"%s\" },\n  \"benchmarks\": [\n", DMLINQ_VERSION);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto& r = results[i];
+        std::printf("    { \"name\": \"%s/%s/%zu\", \"operator\": \"%s\", \"type\": \"%s\", \"size\": %zu, \"iterations\": %zu, "
+            "\"ns_per_iteration\": %.1f, \"ns_per_element\": %.4f, \"bytes_allocated_per_iteration\": %.1f, "
+            "\"allocations_per_iteration\": %.2f, \"peak_rss_bytes\": %zu }%s\n",
+            r.name.c_str(), r.type.c_str(), r.size, r.name.c_str(), r.type.c_str(), r.size, r.iterations,
+            r.ns_per_iteration, r.ns_per_element, r.bytes_per_iteration, r.allocations_per_iteration, r.peak_rss,
+            i + 1 < results.size() ? "," : "");
+    }
+    std::printf("  ]\n}\n");
+}
+
+static bool parseOptions(int argc, char* argv[], BenchOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--json") { options.json = true; }
+        else if (arg == "--filter" && has_value) { options.filter = argv[++i]; }
+        else if (arg == "--max-size" && has_value) { options.max_size = std::strtoull(argv[++i], nullptr, 10); }
+        else if (arg == "--min-time" && has_value) { options.min_time = std::strtod(argv[++i], nullptr); }
+        else {
+            std::fprintf(stderr, "usage: %s [--json] [--filter <substring>] [--max-size <n>] [--min-time <seconds>]\n", argv[0]);
+            return false;
+        }
+    }
+    options.max_size = (std::min)(options.max_size, static_cast<size_t>(100000000));
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    if (!parseOptions(argc, argv, options)) { return 1; }
+
+    if (!options.json) { printTableHeader(); }
+    std::vector<BenchResult> results;
+    for (size_t size = 1000; size <= options.max_size; size *= 10) {
+        // Only one element type's input is alive at a time so the largest sizes fit in memory.
+        std::vector<BenchCase> cases;
+        auto runCases = [&]() {
+            for (const auto& bench : cases) {
+                results.push_back(runCase(bench, options));
+                if (!options.json) { printTableRow(results.back()); }
+            }
+            cases.clear();
+        };
+        addCases<int>(cases, "int", size, options);
+        runCases();
+        addCases<double>(cases, "double", size, options);
+        runCases();
+        addCases<WideRecord>(cases, "wide128", size, options);
+        runCases();
+    }
+    if (options.json) { printJson(results); }
+    return 0;
+}
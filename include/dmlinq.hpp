@@ -1,292 +1,4021 @@
 ﻿#ifndef __DMLINQ_HPP_INCLUDE__
 #define __DMLINQ_HPP_INCLUDE__
 
+#include "dmlinq_config.h"
+
 #include <vector>
 #include <functional>
 #include <memory>
+#include <memory_resource>
+#include <atomic>
 #include <optional>
+#include <deque>
+#include <any>
+#include <typeindex>
 #include <numeric>
+#include <cmath>
+#include <chrono>
+#include <ctime>
 #include <map>
 #include <set>
+#include <unordered_map>
+#include <unordered_set>
 #include <stdexcept>
 #include <algorithm>
 #include <limits>
+#include <queue>
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <new>
+#include <cstddef>
 #include <type_traits> // Required for C++17 type traits
+#include <thread>
+#include <exception>
+#if defined(DMLINQ_ENABLE_NUMA)
+#include <numa.h>
+#include <numaif.h>
+#endif
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#include <exception>
+#define DMLINQ_HAS_COROUTINES 1
+#endif
+#endif
+
+// Inline storage (bytes) reserved for each filter/sort key callable; larger callables go to the heap.
+#ifndef DMLINQ_INLINE_CALLABLE_SIZE
+#define DMLINQ_INLINE_CALLABLE_SIZE 48
+#endif
 
 namespace dmlinq {
 
     // Forward declaration
     template <typename T>
-    class DmLinq;
+    class DmLinq;
+    template <typename T>
+    class IndexedVector;
+
+    // Entry point for starting a LINQ query
+    template <typename T>
+    [[nodiscard]] DmLinq<T> from(const std::vector<T>& source);
+    template <typename T>
+    [[nodiscard]] DmLinq<T> from(std::vector<T>&& source);
+    template <typename T>
+    [[nodiscard]] DmLinq<T> from(const IndexedVector<T>& table);
+    // Single-pass pull sources: pull() returns std::optional<T> (nullopt ends the sequence);
+    // fetch_page() returns a container of rows (an empty page ends the sequence).
+    template <typename TPull>
+    [[nodiscard]] auto fromGenerator(TPull pull) -> DmLinq<typename std::invoke_result_t<TPull&>::value_type>;
+    template <typename TFetch>
+    [[nodiscard]] auto fromPages(TFetch fetch_page) -> DmLinq<typename std::invoke_result_t<TFetch&>::value_type>;
+
+
+    // Enum for sorting direction
+    enum class SortDirection {
+        ASC,
+        DESC
+    };
+
+    // Type-erased callable with small-buffer storage. Callables up to Capacity bytes (and nothrow
+    // movable) are stored inline, so capturing a few values never touches the heap.
+    template <typename TSignature, size_t Capacity = DMLINQ_INLINE_CALLABLE_SIZE>
+    class InlineFunction;
+
+    template <typename R, typename... Args, size_t Capacity>
+    class InlineFunction<R(Args...), Capacity> {
+        static_assert(Capacity >= sizeof(void*), "InlineFunction capacity must hold at least a pointer.");
+    public:
+        InlineFunction() noexcept = default;
+        template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, InlineFunction> && std::is_invocable_r_v<R, std::decay_t<F>&, Args...>>>
+        InlineFunction(F&& f) { emplace<std::decay_t<F>>(std::forward<F>(f)); }
+        InlineFunction(const InlineFunction& other) { if (other.m_vtable) { other.m_vtable->copy(m_storage, other.m_storage); m_vtable = other.m_vtable; } }
+        InlineFunction(InlineFunction&& other) noexcept { if (other.m_vtable) { other.m_vtable->move(m_storage, other.m_storage); m_vtable = other.m_vtable; other.reset(); } }
+        InlineFunction& operator=(const InlineFunction& other) { if (this != &other) { InlineFunction copy(other); *this = std::move(copy); } return *this; }
+        InlineFunction& operator=(InlineFunction&& other) noexcept {
+            if (this != &other) {
+                reset();
+                if (other.m_vtable) { other.m_vtable->move(m_storage, other.m_storage); m_vtable = other.m_vtable; other.reset(); }
+            }
+            return *this;
+        }
+        ~InlineFunction() { reset(); }
+
+        R operator()(Args... args) const { return m_vtable->invoke(const_cast<unsigned char*>(m_storage), std::forward<Args>(args)...); }
+        explicit operator bool() const noexcept { return m_vtable != nullptr; }
+        template <typename F> static constexpr bool storedInline() { return sizeof(F) <= Capacity && alignof(F) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible_v<F>; }
+
+    private:
+        struct VTable {
+            R(*invoke)(void*, Args&&...);
+            void (*copy)(void*, const void*);
+            void (*move)(void*, void*) noexcept;
+            void (*destroy)(void*) noexcept;
+        };
+
+        template <typename F>
+        static const VTable* inlineTable() {
+            static const VTable table = {
+                [](void* self, Args&&... args) -> R { return (*static_cast<F*>(self))(std::forward<Args>(args)...); },
+                [](void* dst, const void* src) { ::new (dst) F(*static_cast<const F*>(src)); },
+                [](void* dst, void* src) noexcept { ::new (dst) F(std::move(*static_cast<F*>(src))); },
+                [](void* self) noexcept { static_cast<F*>(self)->~F(); }
+            };
+            return &table;
+        }
+        template <typename F>
+        static const VTable* heapTable() {
+            static const VTable table = {
+                [](void* self, Args&&... args) -> R { return (**static_cast<F**>(self))(std::forward<Args>(args)...); },
+                [](void* dst, const void* src) { ::new (dst) F*(new F(**static_cast<F* const*>(src))); },
+                [](void* dst, void* src) noexcept { ::new (dst) F*(*static_cast<F**>(src)); *static_cast<F**>(src) = nullptr; },
+                [](void* self) noexcept { delete *static_cast<F**>(self); }
+            };
+            return &table;
+        }
+        template <typename F, typename TArg>
+        void emplace(TArg&& f) {
+            if constexpr (storedInline<F>()) { ::new (static_cast<void*>(m_storage)) F(std::forward<TArg>(f)); m_vtable = inlineTable<F>(); }
+            else { ::new (static_cast<void*>(m_storage)) F*(new F(std::forward<TArg>(f))); m_vtable = heapTable<F>(); }
+        }
+        void reset() noexcept { if (m_vtable) { m_vtable->destroy(m_storage); m_vtable = nullptr; } }
+
+        alignas(std::max_align_t) unsigned char m_storage[Capacity];
+        const VTable* m_vtable = nullptr;
+    };
+
+    namespace detail {
+        // Vector with room for N elements inline; only grows onto the heap past that.
+        template <typename T, size_t N>
+        class SmallVector {
+        public:
+            SmallVector() noexcept = default;
+            SmallVector(const SmallVector& other) { reserve(other.m_size); for (const auto& item : other) { emplace_back(item); } }
+            SmallVector(SmallVector&& other) noexcept(std::is_nothrow_move_constructible_v<T>) { take(std::move(other)); }
+            SmallVector& operator=(const SmallVector& other) { if (this != &other) { SmallVector copy(other); clear(); release(); take(std::move(copy)); } return *this; }
+            SmallVector& operator=(SmallVector&& other) noexcept(std::is_nothrow_move_constructible_v<T>) { if (this != &other) { clear(); release(); take(std::move(other)); } return *this; }
+            ~SmallVector() { clear(); release(); }
+
+            template <typename... TArgs>
+            T& emplace_back(TArgs&&... args) {
+                if (m_size == m_capacity) { reserve(m_capacity * 2); }
+                T* item = ::new (static_cast<void*>(m_data + m_size)) T(std::forward<TArgs>(args)...);
+                ++m_size;
+                return *item;
+            }
+            void push_back(const T& item) { emplace_back(item); }
+            void push_back(T&& item) { emplace_back(std::move(item)); }
+            void clear() noexcept { for (size_t i = 0; i < m_size; ++i) { m_data[i].~T(); } m_size = 0; }
+            void reserve(size_t capacity) {
+                if (capacity <= m_capacity) return;
+                T* data = static_cast<T*>(::operator new(capacity * sizeof(T)));
+                for (size_t i = 0; i < m_size; ++i) { ::new (static_cast<void*>(data + i)) T(std::move(m_data[i])); m_data[i].~T(); }
+                release();
+                m_data = data;
+                m_capacity = capacity;
+            }
+
+            size_t size() const noexcept { return m_size; }
+            bool empty() const noexcept { return m_size == 0; }
+            T& operator[](size_t i) { return m_data[i]; }
+            const T& operator[](size_t i) const { return m_data[i]; }
+            T* begin() noexcept { return m_data; }
+            T* end() noexcept { return m_data + m_size; }
+            const T* begin() const noexcept { return m_data; }
+            const T* end() const noexcept { return m_data + m_size; }
+
+        private:
+            T* inlineData() noexcept { return reinterpret_cast<T*>(m_inline); }
+            void release() noexcept { if (m_data != inlineData()) { ::operator delete(m_data); m_data = inlineData(); m_capacity = N; } }
+            void take(SmallVector&& other) {
+                if (other.m_data != other.inlineData()) {
+                    m_data = other.m_data; m_size = other.m_size; m_capacity = other.m_capacity;
+                    other.m_data = other.inlineData(); other.m_size = 0; other.m_capacity = N;
+                    return;
+                }
+                for (size_t i = 0; i < other.m_size; ++i) { ::new (static_cast<void*>(m_data + i)) T(std::move(other.m_data[i])); }
+                m_size = other.m_size;
+                other.clear();
+            }
+
+            alignas(T) unsigned char m_inline[N * sizeof(T)];
+            T* m_data = inlineData();
+            size_t m_size = 0;
+            size_t m_capacity = N;
+        };
+
+        // Multi-key ordering kept as a flat list of three-way key comparisons evaluated in a loop,
+        // rather than thenBy() wrapping the previous comparator in another closure.
+        template <typename T>
+        class KeyComparator {
+        public:
+            using KeyCompare = InlineFunction<int(const T&, const T&)>;
+
+            template <typename TFunc>
+            void add(TFunc key_selector, SortDirection direction) {
+                bool descending = direction == SortDirection::DESC;
+                m_keys.emplace_back([key_selector, descending](const T& a, const T& b) {
+                    const auto& keyA = key_selector(a);
+                    const auto& keyB = key_selector(b);
+                    int order = (keyA < keyB) ? -1 : ((keyB < keyA) ? 1 : 0);
+                    return descending ? -order : order;
+                    });
+            }
+            void clear() { m_keys.clear(); }
+            explicit operator bool() const noexcept { return !m_keys.empty(); }
+            bool operator()(const T& a, const T& b) const {
+                for (const auto& key : m_keys) {
+                    int order = key(a, b);
+                    if (order != 0) return order < 0;
+                }
+                return false;
+            }
+
+        private:
+            SmallVector<KeyCompare, 4> m_keys;
+        };
+    } // namespace detail
+
+    // One operator in the tree returned by DmLinq::explain(); children are the operator's inputs.
+    // estimated_rows is empty when the planner cannot bound the output (e.g. selectMany).
+    struct PlanNode {
+        std::string op;
+        std::string algorithm;
+        std::optional<size_t> estimated_rows;
+        bool materializes = false;
+        std::vector<PlanNode> children;
+    };
+
+    // Per-operator statistics recorded by a profiled query (see withProfiling()).
+    struct OperatorProfile {
+        std::string op;
+        size_t rows_in = 0;
+        size_t rows_out = 0;
+        uint64_t wall_ns = 0;
+        uint64_t cycles = 0;
+        size_t allocations = 0;
+        size_t bytes_allocated = 0;
+        size_t bytes_copied = 0;
+    };
+
+    namespace detail {
+        // Pass-through memory resource that counts what the pipeline allocates.
+        class CountingResource : public std::pmr::memory_resource {
+        public:
+            void reset(std::pmr::memory_resource* upstream) { m_upstream = upstream; m_allocations = 0; m_bytes = 0; }
+            size_t allocations() const { return m_allocations; }
+            size_t bytes() const { return m_bytes; }
+
+        private:
+            void* do_allocate(size_t bytes, size_t alignment) override { ++m_allocations; m_bytes += bytes; return m_upstream->allocate(bytes, alignment); }
+            void do_deallocate(void* p, size_t bytes, size_t alignment) override { m_upstream->deallocate(p, bytes, alignment); }
+            bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+            std::pmr::memory_resource* m_upstream = std::pmr::get_default_resource();
+            size_t m_allocations = 0;
+            size_t m_bytes = 0;
+        };
+    } // namespace detail
+
+    // Report filled by a query run with withProfiling(): one entry per operator, in completion order.
+    // Recording is compiled in only when DMLINQ_ENABLE_PROFILING is defined (see dmlinq_config.h);
+    // otherwise the report stays empty and the pipeline carries no profiling code at all.
+    class QueryProfile {
+    public:
+#ifdef DMLINQ_ENABLE_PROFILING
+        static constexpr bool enabled() { return true; }
+#else
+        static constexpr bool enabled() { return false; }
+#endif
+        const std::vector<OperatorProfile>& operators() const { return m_operators; }
+        uint64_t totalWallNs() const { uint64_t total = 0; for (const auto& op : m_operators) { total += op.wall_ns; } return total; }
+        void clear() { m_operators.clear(); }
+        void record(OperatorProfile op) { m_operators.push_back(std::move(op)); }
+        detail::CountingResource& counter() { return m_counter; }
+
+    private:
+        std::vector<OperatorProfile> m_operators;
+        detail::CountingResource m_counter;
+    };
+
+    // Shared flag for stopping a running query from another thread. Copies refer to the same flag.
+    class CancellationToken {
+    public:
+        CancellationToken() : m_flag(std::make_shared<std::atomic<bool>>(false)) {}
+        void cancel() const { m_flag->store(true, std::memory_order_relaxed); }
+        bool cancelled() const { return m_flag->load(std::memory_order_relaxed); }
+
+    private:
+        std::shared_ptr<std::atomic<bool>> m_flag;
+    };
+
+    enum class QueryStatus { Completed, Cancelled, DeadlineExceeded, RowLimitExceeded, ByteLimitExceeded };
+
+    // Thrown out of a terminal when a QueryLimits check fails; the partial work is discarded.
+    class QueryCancelled : public std::runtime_error {
+    public:
+        QueryCancelled(QueryStatus status, const char* what) : std::runtime_error(what), m_status(status) {}
+        QueryStatus status() const noexcept { return m_status; }
+
+    private:
+        QueryStatus m_status;
+    };
+
+    // Limits enforced while a query runs (see withLimits()). Rows are counted as they leave the
+    // query's sources, before a from() source is copied; bytes are those allocated from the query's
+    // memory resource, i.e. the buffers the pipeline materializes. Cancellation and the deadline are
+    // polled every 1024 rows or comparisons (in-memory and external sorts included) and once per
+    // morsel in parallel scans, so a running query stops within one batch.
+    struct QueryLimits {
+        std::optional<CancellationToken> cancellation;
+        std::optional<std::chrono::steady_clock::time_point> deadline;
+        std::optional<size_t> max_rows_scanned;
+        std::optional<size_t> max_bytes_allocated;
+    };
+
+    // Result of a try* terminal: the rows produced before a limit was hit, and why it stopped.
+    template <typename TValue>
+    struct PartialResult {
+        TValue value;
+        QueryStatus status = QueryStatus::Completed;
+        bool complete() const { return status == QueryStatus::Completed; }
+    };
+
+    namespace detail {
+        // Enforces one execution's QueryLimits. Doubles as the pass-through memory resource that
+        // counts bytes when a byte limit is set, so it must outlive every buffer of the execution.
+        class QueryGuard : public std::pmr::memory_resource {
+        public:
+            void arm(const QueryLimits& limits, std::pmr::memory_resource* upstream) {
+                m_limits = &limits;
+                m_upstream = upstream;
+                m_max_rows = limits.max_rows_scanned.value_or((std::numeric_limits<size_t>::max)());
+                m_max_bytes = limits.max_bytes_allocated.value_or((std::numeric_limits<size_t>::max)());
+                check();
+            }
+            void scanRow() {
+                if (++m_rows > m_max_rows) { throw QueryCancelled(QueryStatus::RowLimitExceeded, "Query exceeded its row limit."); }
+                tick();
+            }
+            void scanRows(size_t rows) {
+                m_rows += rows;
+                if (m_rows > m_max_rows) { throw QueryCancelled(QueryStatus::RowLimitExceeded, "Query exceeded its row limit."); }
+                check();
+            }
+            void tick() {
+                if ((++m_ticks & 1023) == 0) { check(); }
+            }
+            void check() const {
+                if (m_limits->cancellation && m_limits->cancellation->cancelled()) { throw QueryCancelled(QueryStatus::Cancelled, "Query was cancelled."); }
+                if (m_limits->deadline && std::chrono::steady_clock::now() >= *m_limits->deadline) { throw QueryCancelled(QueryStatus::DeadlineExceeded, "Query missed its deadline."); }
+            }
+            bool limitsBytes() const { return m_max_bytes != (std::numeric_limits<size_t>::max)(); }
+
+        private:
+            void* do_allocate(size_t bytes, size_t alignment) override {
+                m_bytes += bytes;
+                if (m_bytes > m_max_bytes) { throw QueryCancelled(QueryStatus::ByteLimitExceeded, "Query exceeded its memory limit."); }
+                return m_upstream->allocate(bytes, alignment);
+            }
+            void do_deallocate(void* p, size_t bytes, size_t alignment) override { m_upstream->deallocate(p, bytes, alignment); }
+            bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+            const QueryLimits* m_limits = nullptr;
+            std::pmr::memory_resource* m_upstream = nullptr;
+            size_t m_max_rows = 0;
+            size_t m_max_bytes = 0;
+            size_t m_rows = 0;
+            size_t m_bytes = 0;
+            size_t m_ticks = 0;
+        };
+
+        // State threaded down the stage chain for one execution.
+        struct ExecutionContext {
+            std::pmr::memory_resource* resource;
+            QueryProfile* profile = nullptr;
+            bool consume_source = false; // the query is expiring; an owned source may be moved out
+            QueryGuard* guard = nullptr; // set when the query has limits
+        };
+
+        inline uint64_t readCycleCounter() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+            return __rdtsc();
+#elif defined(__x86_64__) || defined(__i386__)
+            return __builtin_ia32_rdtsc();
+#else
+            return static_cast<uint64_t>(std::clock());
+#endif
+        }
+
+        // Measures one operator; an empty shell unless DMLINQ_ENABLE_PROFILING is defined.
+        class OperatorScope {
+        public:
+#ifdef DMLINQ_ENABLE_PROFILING
+            OperatorScope(const ExecutionContext& ctx, const char* op, size_t rows_in) : m_profile(ctx.profile) {
+                if (!m_profile) return;
+                m_stats.op = op;
+                m_stats.rows_in = rows_in;
+                m_allocations = m_profile->counter().allocations();
+                m_bytes = m_profile->counter().bytes();
+                m_start = std::chrono::steady_clock::now();
+                m_cycles = readCycleCounter();
+            }
+            void finish(size_t rows_out, size_t bytes_copied) {
+                if (!m_profile) return;
+                m_stats.cycles = readCycleCounter() - m_cycles;
+                m_stats.wall_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count());
+                m_stats.rows_out = rows_out;
+                m_stats.bytes_copied = bytes_copied;
+                m_stats.allocations = m_profile->counter().allocations() - m_allocations;
+                m_stats.bytes_allocated = m_profile->counter().bytes() - m_bytes;
+                m_profile->record(std::move(m_stats));
+            }
+
+        private:
+            QueryProfile* m_profile;
+            OperatorProfile m_stats;
+            size_t m_allocations = 0;
+            size_t m_bytes = 0;
+            std::chrono::steady_clock::time_point m_start;
+            uint64_t m_cycles = 0;
+#else
+            OperatorScope(const ExecutionContext&, const char*, size_t) {}
+            void finish(size_t, size_t) {}
+#endif
+        };
+    } // namespace detail
+
+    namespace detail {
+        // Pull-based view of a stage's output, used by the streaming operators. next() returns
+        // nullptr once the sequence is exhausted; the row it returns stays valid until the next call.
+        template <typename T>
+        class Cursor {
+        public:
+            virtual ~Cursor() = default;
+            virtual const T* next() = 0;
+        };
+
+        template <typename T, typename TNext>
+        class FunctionCursor : public Cursor<T> {
+        public:
+            explicit FunctionCursor(TNext next) : m_next(std::move(next)) {}
+            const T* next() override { return m_next(); }
+
+        private:
+            TNext m_next;
+        };
+
+        template <typename T, typename TNext>
+        std::unique_ptr<Cursor<T>> makeCursor(TNext next) {
+            return std::make_unique<FunctionCursor<T, TNext>>(std::move(next));
+        }
+
+        // One incremental (async) run of a query. Members are destroyed in reverse order, so the
+        // cursor hands its buffers back through the guard (the byte-limit resource) while the guard
+        // is still alive, and the guard's limits, owned by the query, outlive both.
+        template <typename TQuery, typename T>
+        struct AsyncRun {
+            std::shared_ptr<TQuery> query;
+            QueryGuard guard;
+            std::unique_ptr<Cursor<T>> cursor;
+        };
+
+        // With a guard, every row pulled counts as scanned, so a runaway source stops early.
+        template <typename T>
+        std::pmr::vector<T> drainCursor(Cursor<T>& cursor, std::pmr::memory_resource* resource, QueryGuard* guard = nullptr) {
+            std::pmr::vector<T> rows(resource);
+            while (const T* row = cursor.next()) {
+                if (guard) { guard->scanRow(); }
+                rows.push_back(*row);
+            }
+            return rows;
+        }
+
+        // Default selector for operators that can work on the rows themselves.
+        struct Identity {
+            template <typename U> U operator()(const U& value) const { return value; }
+        };
+
+        // Comparator that polls the query's limits, so a long sort can be stopped part way.
+        template <typename TCompare>
+        auto guardedCompare(const TCompare& compare, QueryGuard& guard) {
+            return [&compare, &guard](const auto& a, const auto& b) {
+                guard.tick();
+                return compare(a, b);
+                };
+        }
+
+        // splitmix64 finalizer: std::hash is the identity for integers on the common standard
+        // libraries, so its bits have to be spread before they can pick blocks and bit positions.
+        template <typename TKey>
+        uint64_t mixedHash(const TKey& key) {
+            uint64_t h = static_cast<uint64_t>(std::hash<TKey>{}(key)) + 0x9e3779b97f4a7c15ull;
+            h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+            h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+            return h ^ (h >> 31);
+        }
+
+        // splitmix64 generator; unlike the <random> distributions it gives the same sequence on
+        // every standard library, so a seeded sample is reproducible across platforms.
+        class SplitMix64 {
+        public:
+            explicit SplitMix64(uint64_t seed) : m_state(seed) {}
+            uint64_t next() {
+                uint64_t z = (m_state += 0x9e3779b97f4a7c15ull);
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+                return z ^ (z >> 31);
+            }
+            // Uniform in the open interval (0, 1), so its logarithm is always finite.
+            double uniform() { return (static_cast<double>(next() >> 11) + 0.5) * 0x1.0p-53; }
+            size_t below(size_t bound) { return static_cast<size_t>(uniform() * static_cast<double>(bound)); }
+
+        private:
+            uint64_t m_state;
+        };
+
+        // Number of rows to skip for a geometric gap floor(log(u) / log1p(-p)). The ratio becomes
+        // infinite once p underflows to zero, so it is clamped before the conversion to size_t.
+        inline size_t geometricGap(double u, double p) {
+            double gap = std::floor(std::log(u) / std::log1p(-p));
+            if (!(gap < static_cast<double>((std::numeric_limits<size_t>::max)()))) { return (std::numeric_limits<size_t>::max)(); }
+            return gap > 0.0 ? static_cast<size_t>(gap) : 0;
+        }
+
+        inline unsigned countLeadingZeros(uint64_t value) {
+#if defined(_MSC_VER) && defined(_M_X64)
+            unsigned long index;
+            return _BitScanReverse64(&index, value) ? 63u - static_cast<unsigned>(index) : 64u;
+#elif defined(__GNUC__) || defined(__clang__)
+            return value ? static_cast<unsigned>(__builtin_clzll(value)) : 64u;
+#else
+            unsigned n = 0;
+            for (uint64_t bit = uint64_t{ 1 } << 63; bit && !(value & bit); bit >>= 1) { ++n; }
+            return n;
+#endif
+        }
+
+        // Open-addressing hash table (linear probing, power-of-two size) that numbers distinct keys
+        // 0, 1, 2, ... in insertion order. Keys live in one dense array and the probe table only
+        // holds indexes into it, so there is no allocation per key and the keys iterate in order.
+        template <typename TKey>
+        class FlatKeyIndex {
+        public:
+            explicit FlatKeyIndex(std::pmr::memory_resource* resource) : m_keys(resource), m_slots(resource) {}
+
+            // Index of `key`, and whether this call inserted it.
+            std::pair<size_t, bool> insert(const TKey& key) {
+                if ((m_keys.size() + 1) * 10 > m_slots.size() * 7) { grow(); }
+                size_t mask = m_slots.size() - 1;
+                for (size_t i = static_cast<size_t>(mixedHash(key)) & mask;; i = (i + 1) & mask) {
+                    if (m_slots[i] == 0) {
+                        m_keys.push_back(key);
+                        m_slots[i] = m_keys.size();
+                        return { m_keys.size() - 1, true };
+                    }
+                    if (m_keys[m_slots[i] - 1] == key) return { m_slots[i] - 1, false };
+                }
+            }
+            size_t size() const { return m_keys.size(); }
+            std::pmr::vector<TKey>& keys() { return m_keys; }
+
+        private:
+            void grow() {
+                m_slots.assign((std::max)(size_t{ 16 }, m_slots.size() * 2), 0);
+                size_t mask = m_slots.size() - 1;
+                for (size_t k = 0; k < m_keys.size(); ++k) {
+                    size_t i = static_cast<size_t>(mixedHash(m_keys[k])) & mask;
+                    while (m_slots[i] != 0) { i = (i + 1) & mask; }
+                    m_slots[i] = k + 1;
+                }
+            }
+
+            std::pmr::vector<TKey> m_keys;
+            std::pmr::vector<size_t> m_slots; // 0 = empty, otherwise key index + 1
+        };
+    } // namespace detail
+
+    // Instrumentation for asserting on the work a pipeline does: element copies, moves and
+    // comparisons (through the Counted<T> wrapper) and pipeline allocations (through resource()).
+    // Counters are process-wide and only ever touched by instrumented types, so they cost nothing
+    // to queries that do not use them.
+    namespace instrument {
+        struct Counts {
+            size_t allocations = 0;
+            size_t bytes_allocated = 0;
+            size_t copies = 0;
+            size_t moves = 0;
+            size_t comparisons = 0;
+
+            Counts operator-(const Counts& rhs) const {
+                return Counts{ allocations - rhs.allocations, bytes_allocated - rhs.bytes_allocated,
+                    copies - rhs.copies, moves - rhs.moves, comparisons - rhs.comparisons };
+            }
+        };
+
+        inline std::atomic<size_t> g_allocations{ 0 };
+        inline std::atomic<size_t> g_bytes_allocated{ 0 };
+        inline std::atomic<size_t> g_copies{ 0 };
+        inline std::atomic<size_t> g_moves{ 0 };
+        inline std::atomic<size_t> g_comparisons{ 0 };
+
+        inline Counts counts() {
+            return Counts{ g_allocations.load(), g_bytes_allocated.load(), g_copies.load(), g_moves.load(), g_comparisons.load() };
+        }
+        inline void reset() {
+            g_allocations = 0; g_bytes_allocated = 0; g_copies = 0; g_moves = 0; g_comparisons = 0;
+        }
+
+        // new/delete backed resource that counts every allocation into the global counters.
+        class CountingResource : public std::pmr::memory_resource {
+        private:
+            void* do_allocate(size_t bytes, size_t alignment) override {
+                g_allocations.fetch_add(1, std::memory_order_relaxed);
+                g_bytes_allocated.fetch_add(bytes, std::memory_order_relaxed);
+                return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+            }
+            void do_deallocate(void* p, size_t bytes, size_t alignment) override { std::pmr::new_delete_resource()->deallocate(p, bytes, alignment); }
+            bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+        };
+
+        inline std::pmr::memory_resource* resource() {
+            static CountingResource counting;
+            return &counting;
+        }
+
+        // Resets the counters and routes default-resource pipeline allocations through resource()
+        // for its lifetime; counts() then reports what happened inside the scope.
+        class Scope {
+        public:
+            Scope() : m_previous(std::pmr::set_default_resource(resource())) { reset(); }
+            ~Scope() { std::pmr::set_default_resource(m_previous); }
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+            Counts counts() const { return instrument::counts(); }
+
+        private:
+            std::pmr::memory_resource* m_previous;
+        };
+
+        // Element wrapper that counts its copies, moves and comparisons.
+        template <typename T>
+        class Counted {
+        public:
+            Counted() = default;
+            Counted(T value) : m_value(std::move(value)) {}
+            Counted(const Counted& other) : m_value(other.m_value) { g_copies.fetch_add(1, std::memory_order_relaxed); }
+            Counted(Counted&& other) noexcept(std::is_nothrow_move_constructible_v<T>) : m_value(std::move(other.m_value)) { g_moves.fetch_add(1, std::memory_order_relaxed); }
+            Counted& operator=(const Counted& other) { m_value = other.m_value; g_copies.fetch_add(1, std::memory_order_relaxed); return *this; }
+            Counted& operator=(Counted&& other) noexcept(std::is_nothrow_move_assignable_v<T>) { m_value = std::move(other.m_value); g_moves.fetch_add(1, std::memory_order_relaxed); return *this; }
+
+            const T& get() const { return m_value; }
+
+            friend bool operator<(const Counted& a, const Counted& b) { g_comparisons.fetch_add(1, std::memory_order_relaxed); return a.m_value < b.m_value; }
+            friend bool operator>(const Counted& a, const Counted& b) { return b < a; }
+            friend bool operator<=(const Counted& a, const Counted& b) { return !(b < a); }
+            friend bool operator>=(const Counted& a, const Counted& b) { return !(a < b); }
+            friend bool operator==(const Counted& a, const Counted& b) { g_comparisons.fetch_add(1, std::memory_order_relaxed); return a.m_value == b.m_value; }
+            friend bool operator!=(const Counted& a, const Counted& b) { return !(a == b); }
+
+        private:
+            T m_value{};
+        };
+    } // namespace instrument
+
+    // Query-scoped arena: buffers, hash tables and sort scratch allocated while a query runs come
+    // from here and are handed back in one shot by release() or the destructor. Attach it with
+    // withArena(); results returned by terminals are ordinary heap objects and outlive the arena.
+    // Only row buffers and the stage snapshots chained after withArena() are carved from the arena;
+    // operator closures and their captures still come from the global heap. Those snapshots make
+    // the arena part of the query's state: destroy every query built on it (including queries
+    // derived from one) before calling release() or destroying the arena, and never run such a
+    // query afterwards. release() ends a batch of queries; it does not reset one between runs.
+    class QueryArena {
+    public:
+        explicit QueryArena(size_t initial_size = 64 * 1024) : m_resource(initial_size) {}
+        QueryArena(void* buffer, size_t size) : m_resource(buffer, size) {}
+        std::pmr::memory_resource* resource() { return &m_resource; }
+        void release() { m_resource.release(); }
+
+    private:
+        std::pmr::monotonic_buffer_resource m_resource;
+    };
+
+#ifdef DMLINQ_HAS_COROUTINES
+    // Minimal C++20 generator for from(Generator<T>): a coroutine that co_yields rows.
+    template <typename T>
+    class Generator {
+    public:
+        struct promise_type {
+            std::optional<T> current;
+            std::exception_ptr error;
+
+            Generator get_return_object() { return Generator(std::coroutine_handle<promise_type>::from_promise(*this)); }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            std::suspend_always final_suspend() noexcept { return {}; }
+            std::suspend_always yield_value(T value) { current = std::move(value); return {}; }
+            void return_void() {}
+            void unhandled_exception() { error = std::current_exception(); }
+        };
+
+        explicit Generator(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+        Generator(Generator&& other) noexcept : m_handle(std::exchange(other.m_handle, {})) {}
+        Generator& operator=(Generator&& other) noexcept { std::swap(m_handle, other.m_handle); return *this; }
+        Generator(const Generator&) = delete;
+        Generator& operator=(const Generator&) = delete;
+        ~Generator() { if (m_handle) m_handle.destroy(); }
+
+        // Resumes the coroutine up to its next co_yield.
+        std::optional<T> next() {
+            if (!m_handle || m_handle.done()) return std::nullopt;
+            m_handle.promise().current.reset();
+            m_handle.resume();
+            if (m_handle.promise().error) std::rethrow_exception(m_handle.promise().error);
+            return std::move(m_handle.promise().current);
+        }
+
+    private:
+        std::coroutine_handle<promise_type> m_handle;
+    };
+
+    template <typename T>
+    [[nodiscard]] DmLinq<T> from(Generator<T> generator);
+#endif
+
+    // Incremental terminal returned by toVectorAsync()/forEachAsync(). Each step() processes one
+    // batch of rows and returns true once the query has finished, so an event loop can interleave
+    // other work between batches; drive() does that by re-posting itself. Copies share one run.
+    // Sorting or grouping stages still run to completion inside the first step.
+    template <typename TResult>
+    class AsyncQuery {
+    public:
+        AsyncQuery(std::function<bool()> step, std::shared_ptr<TResult> result)
+            : m_state(std::make_shared<State>(State{ std::move(step), std::move(result), false, false })) {}
+
+        bool step() {
+            if (!m_state->finished) { m_state->finished = m_state->step(); }
+            return m_state->finished;
+        }
+        bool done() const { return m_state->finished; }
+        // Moves the result out, so it can be taken once; copies of an AsyncQuery share that result.
+        TResult get() {
+            if (!m_state->finished) { throw std::runtime_error("AsyncQuery::get() called before the query finished."); }
+            if (m_state->taken) { throw std::runtime_error("AsyncQuery::get() called after the result was already taken."); }
+            m_state->taken = true;
+            return std::move(*m_state->result);
+        }
+        // post(task) must schedule task to run later, e.g. on an event loop; on_done receives the result.
+        template <typename TPost, typename TDone>
+        void drive(TPost post, TDone on_done) {
+            AsyncQuery self = *this;
+            post([self, post, on_done]() mutable {
+                if (self.step()) { on_done(self.get()); }
+                else { self.drive(post, on_done); }
+                });
+        }
+
+    private:
+        struct State {
+            std::function<bool()> step;
+            std::shared_ptr<TResult> result;
+            bool finished;
+            bool taken;
+        };
+        std::shared_ptr<State> m_state;
+    };
+
+    namespace detail {
+        template <typename U> struct TypeIdentity { using type = U; };
+        template <typename U> using TypeIdentityT = typename TypeIdentity<U>::type;
+
+        // Sorted, disjoint half-open [begin, end) row ranges of a source selected by index probes.
+        using RowRanges = std::vector<std::pair<size_t, size_t>>;
+
+        inline RowRanges rangesFromPositions(const std::vector<size_t>& sorted_positions) {
+            RowRanges ranges;
+            for (size_t position : sorted_positions) {
+                if (!ranges.empty() && ranges.back().second == position) { ++ranges.back().second; }
+                else { ranges.emplace_back(position, position + 1); }
+            }
+            return ranges;
+        }
+        inline RowRanges intersectRanges(const RowRanges& a, const RowRanges& b) {
+            RowRanges result;
+            size_t i = 0, j = 0;
+            while (i < a.size() && j < b.size()) {
+                size_t begin = (std::max)(a[i].first, b[j].first);
+                size_t end = (std::min)(a[i].second, b[j].second);
+                if (begin < end) result.emplace_back(begin, end);
+                if (a[i].second < b[j].second) ++i; else ++j;
+            }
+            return result;
+        }
+        inline size_t rowCount(const RowRanges& ranges) {
+            size_t n = 0;
+            for (const auto& range : ranges) n += range.second - range.first;
+            return n;
+        }
+    } // namespace detail
+
+    // Equality index: key -> ascending row positions. Built once by IndexedVector::addHashIndex().
+    template <typename T, typename TKey>
+    class HashIndex {
+    public:
+        template <typename TFunc>
+        HashIndex(std::shared_ptr<std::vector<T>> rows, TFunc key_selector) : m_rows(std::move(rows)) {
+            for (size_t i = 0; i < m_rows->size(); ++i) { m_positions[key_selector((*m_rows)[i])].push_back(i); }
+        }
+        const std::shared_ptr<std::vector<T>>& rows() const { return m_rows; }
+        detail::RowRanges probe(const TKey& key) const {
+            auto it = m_positions.find(key);
+            return it == m_positions.end() ? detail::RowRanges() : detail::rangesFromPositions(it->second);
+        }
+
+    private:
+        std::shared_ptr<std::vector<T>> m_rows;
+        std::unordered_map<TKey, std::vector<size_t>> m_positions;
+    };
+
+    // Range index: (key, position) pairs sorted by key in one flat array, so a probe is two binary
+    // searches over contiguous memory rather than a pointer-chasing tree walk.
+    template <typename T, typename TKey>
+    class OrderedIndex {
+    public:
+        template <typename TFunc>
+        OrderedIndex(std::shared_ptr<std::vector<T>> rows, TFunc key_selector) : m_rows(std::move(rows)) {
+            m_entries.reserve(m_rows->size());
+            for (size_t i = 0; i < m_rows->size(); ++i) { m_entries.emplace_back(key_selector((*m_rows)[i]), i); }
+            std::stable_sort(m_entries.begin(), m_entries.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+        }
+        const std::shared_ptr<std::vector<T>>& rows() const { return m_rows; }
+        // Rows with lo <= key <= hi.
+        detail::RowRanges probe(const TKey& lo, const TKey& hi) const {
+            auto first = std::lower_bound(m_entries.begin(), m_entries.end(), lo, [](const auto& entry, const TKey& key) { return entry.first < key; });
+            auto last = std::upper_bound(first, m_entries.end(), hi, [](const TKey& key, const auto& entry) { return key < entry.first; });
+            std::vector<size_t> positions;
+            positions.reserve(static_cast<size_t>(last - first));
+            for (auto it = first; it != last; ++it) positions.push_back(it->second);
+            std::sort(positions.begin(), positions.end());
+            return detail::rangesFromPositions(positions);
+        }
+
+    private:
+        std::shared_ptr<std::vector<T>> m_rows;
+        std::vector<std::pair<TKey, size_t>> m_entries;
+    };
+
+    // Zone map: per-block min/max of one key. A range probe keeps only the blocks whose [min, max]
+    // overlaps the range, so on roughly ordered data (timestamps, ids) most blocks are never read.
+    template <typename T, typename TKey>
+    class ZoneMap {
+    public:
+        template <typename TFunc>
+        ZoneMap(std::shared_ptr<std::vector<T>> rows, TFunc key_selector, size_t block_size)
+            : m_rows(std::move(rows)), m_key_selector(key_selector), m_block_size(block_size) {
+            if (m_block_size == 0) { throw std::runtime_error("ZoneMap block size must be greater than zero."); }
+            for (size_t begin = 0; begin < m_rows->size(); begin += m_block_size) {
+                size_t end = (std::min)(begin + m_block_size, m_rows->size());
+                TKey lo = m_key_selector((*m_rows)[begin]);
+                TKey hi = lo;
+                for (size_t i = begin + 1; i < end; ++i) {
+                    TKey key = m_key_selector((*m_rows)[i]);
+                    if (key < lo) lo = key;
+                    if (hi < key) hi = key;
+                }
+                m_zones.emplace_back(std::move(lo), std::move(hi));
+            }
+        }
+        const std::shared_ptr<std::vector<T>>& rows() const { return m_rows; }
+        const std::function<TKey(const T&)>& keySelector() const { return m_key_selector; }
+        size_t blockCount() const { return m_zones.size(); }
+        // Blocks that may hold rows with lo <= key <= hi; adjacent blocks are merged.
+        detail::RowRanges probe(const TKey& lo, const TKey& hi) const {
+            detail::RowRanges ranges;
+            for (size_t block = 0; block < m_zones.size(); ++block) {
+                if (m_zones[block].second < lo || hi < m_zones[block].first) continue;
+                size_t begin = block * m_block_size;
+                size_t end = (std::min)(begin + m_block_size, m_rows->size());
+                if (!ranges.empty() && ranges.back().second == begin) { ranges.back().second = end; }
+                else { ranges.emplace_back(begin, end); }
+            }
+            return ranges;
+        }
+
+    private:
+        std::shared_ptr<std::vector<T>> m_rows;
+        std::function<TKey(const T&)> m_key_selector;
+        size_t m_block_size;
+        std::vector<std::pair<TKey, TKey>> m_zones;
+    };
+
+    // A mostly static source with secondary indexes. Rows are immutable once indexed; query it with
+    // from(table) and narrow the scan with DmLinq::whereIndexed(). Index references stay valid for
+    // the table's lifetime.
+    template <typename T>
+    class IndexedVector {
+    public:
+        explicit IndexedVector(std::vector<T> rows) : m_rows(std::make_shared<std::vector<T>>(std::move(rows))) {}
+
+        template <typename TFunc>
+        const HashIndex<T, std::decay_t<std::invoke_result_t<TFunc, const T&>>>& addHashIndex(TFunc key_selector) {
+            return addIndex(std::make_shared<HashIndex<T, std::decay_t<std::invoke_result_t<TFunc, const T&>>>>(m_rows, key_selector));
+        }
+        template <typename TFunc>
+        const OrderedIndex<T, std::decay_t<std::invoke_result_t<TFunc, const T&>>>& addOrderedIndex(TFunc key_selector) {
+            return addIndex(std::make_shared<OrderedIndex<T, std::decay_t<std::invoke_result_t<TFunc, const T&>>>>(m_rows, key_selector));
+        }
+        template <typename TFunc>
+        const ZoneMap<T, std::decay_t<std::invoke_result_t<TFunc, const T&>>>& addZoneMap(TFunc key_selector, size_t block_size = 1024) {
+            return addIndex(std::make_shared<ZoneMap<T, std::decay_t<std::invoke_result_t<TFunc, const T&>>>>(m_rows, key_selector, block_size));
+        }
+        const std::vector<T>& rows() const { return *m_rows; }
+        size_t size() const { return m_rows->size(); }
+
+    private:
+        template <typename TIndex>
+        const TIndex& addIndex(std::shared_ptr<TIndex> index) { m_indexes.push_back(index); return *index; }
+
+        std::shared_ptr<std::vector<T>> m_rows;
+        std::vector<std::shared_ptr<void>> m_indexes;
+
+        friend DmLinq<T> from<T>(const IndexedVector<T>& table);
+    };
+
+    // count/sum/average/min/max over one set of values, maintained under inserts and removals.
+    // min/max come from an ordered multiset, so every delta is O(log n).
+    template <typename TValue>
+    class ViewAggregates {
+    public:
+        size_t count() const { return m_values.size(); }
+        TValue sum() const { return m_sum; }
+        double average() const { return m_values.empty() ? 0.0 : static_cast<double>(m_sum) / static_cast<double>(m_values.size()); }
+        std::optional<TValue> min() const { return m_values.empty() ? std::nullopt : std::optional<TValue>(*m_values.begin()); }
+        std::optional<TValue> max() const { return m_values.empty() ? std::nullopt : std::optional<TValue>(*m_values.rbegin()); }
+
+        void add(const TValue& value) { m_values.insert(value); m_sum += value; }
+        bool remove(const TValue& value) {
+            auto it = m_values.find(value);
+            if (it == m_values.end()) return false;
+            m_values.erase(it);
+            m_sum -= value;
+            return true;
+        }
+
+    private:
+        std::multiset<TValue> m_values;
+        TValue m_sum{};
+    };
+
+    // Fixed-width histogram: counts[i] holds the values in [lo + i * width, lo + (i + 1) * width),
+    // with hi itself counted in the last bin. Values below lo or above hi (and NaN) are only
+    // tallied in underflow and overflow.
+    struct Histogram {
+        double lo = 0.0;
+        double hi = 0.0;
+        double width = 0.0;
+        std::vector<size_t> counts;
+        size_t underflow = 0;
+        size_t overflow = 0;
+    };
+
+    namespace detail {
+        // Bins values in blocks: the bin numbers of a block are computed in a branch-free loop the
+        // compiler can vectorize, and only the final increments are scattered.
+        inline void fillHistogram(const double* values, size_t n, Histogram& histogram) {
+            size_t bins = histogram.counts.size();
+            std::vector<size_t> tally(bins + 2, 0);
+            double scale = histogram.width > 0.0 ? 1.0 / histogram.width : 0.0;
+            double lo = histogram.lo;
+            double hi = histogram.hi;
+            double last = static_cast<double>(bins);
+            double outside = static_cast<double>(bins + 1);
+            constexpr size_t kBlock = 256;
+            size_t slots[kBlock];
+            for (size_t base = 0; base < n; base += kBlock) {
+                size_t m = (std::min)(kBlock, n - base);
+                for (size_t i = 0; i < m; ++i) {
+                    double v = values[base + i];
+                    double slot = std::floor((v - lo) * scale) + 1.0;
+                    slot = slot < 0.0 ? 0.0 : slot;
+                    slot = slot > last ? last : slot;
+                    slot = v <= hi ? slot : outside;
+                    slots[i] = static_cast<size_t>(slot);
+                }
+                for (size_t i = 0; i < m; ++i) { ++tally[slots[i]]; }
+            }
+            histogram.underflow += tally[0];
+            histogram.overflow += tally[bins + 1];
+            for (size_t b = 0; b < bins; ++b) { histogram.counts[b] += tally[b + 1]; }
+        }
+    } // namespace detail
+
+    // HyperLogLog distinct-count sketch with 2^precision one-byte registers. Precision ranges from
+    // 4 to 18; the default 14 takes 16 KiB and has a standard error of about 0.8%. Sketches with
+    // the same precision merge by register-wise maximum, so partial sketches built over disjoint
+    // parts of the input combine into the sketch of the whole.
+    class HyperLogLog {
+    public:
+        explicit HyperLogLog(uint8_t precision = 14) : m_precision(precision) {
+            if (precision < 4 || precision > 18) { throw std::runtime_error("HyperLogLog precision must be between 4 and 18."); }
+            m_registers.assign(size_t{ 1 } << precision, 0);
+        }
+
+        template <typename TKey> void add(const TKey& key) { addHash(detail::mixedHash(key)); }
+        void addHash(uint64_t hash) {
+            size_t index = static_cast<size_t>(hash >> (64 - m_precision));
+            // The guard bit caps the rank at 65 - precision when the remaining bits are all zero.
+            uint64_t rest = (hash << m_precision) | (uint64_t{ 1 } << (m_precision - 1));
+            auto rank = static_cast<uint8_t>(detail::countLeadingZeros(rest) + 1);
+            if (rank > m_registers[index]) { m_registers[index] = rank; }
+        }
+        void merge(const HyperLogLog& other) {
+            if (other.m_precision != m_precision) { throw std::runtime_error("Cannot merge HyperLogLog sketches of different precision."); }
+            for (size_t i = 0; i < m_registers.size(); ++i) { m_registers[i] = (std::max)(m_registers[i], other.m_registers[i]); }
+        }
+        // Raw HyperLogLog estimate, with linear counting for small cardinalities. The 64-bit hash
+        // makes the large-range correction of the original paper unnecessary.
+        double estimate() const {
+            double m = static_cast<double>(m_registers.size());
+            double alpha = m_precision == 4 ? 0.673 : m_precision == 5 ? 0.697 : m_precision == 6 ? 0.709 : 0.7213 / (1.0 + 1.079 / m);
+            double sum = 0.0;
+            size_t zeros = 0;
+            for (uint8_t r : m_registers) {
+                sum += std::ldexp(1.0, -static_cast<int>(r));
+                if (r == 0) ++zeros;
+            }
+            double raw = alpha * m * m / sum;
+            if (raw <= 2.5 * m && zeros != 0) { return m * std::log(m / static_cast<double>(zeros)); }
+            return raw;
+        }
+        uint8_t precision() const { return m_precision; }
+
+    private:
+        uint8_t m_precision;
+        std::vector<uint8_t> m_registers;
+    };
+
+    // KLL quantile sketch (Karnin, Lang, Liberty). Level h holds items of weight 2^h; a full level
+    // is sorted and every other item, starting at a random offset, moves up one level. Memory is
+    // O(k log(n / k)) values and the rank error is roughly 1.7 / k. Sketches with the same k
+    // merge, so partial sketches over disjoint inputs combine into the sketch of the whole.
+    class KllSketch {
+    public:
+        explicit KllSketch(size_t k = 200) : m_k(k), m_levels(1) {
+            if (k < 8) { throw std::runtime_error("KllSketch k must be at least 8."); }
+            m_capacity = capacity();
+        }
+
+        void add(double value) {
+            if (m_count == 0 || value < m_min) m_min = value;
+            if (m_count == 0 || m_max < value) m_max = value;
+            m_levels[0].push_back(value);
+            ++m_count;
+            ++m_size;
+            while (m_size >= m_capacity) { compact(); }
+        }
+        void merge(const KllSketch& other) {
+            if (other.m_k != m_k) { throw std::runtime_error("Cannot merge KllSketch sketches with different k."); }
+            if (other.m_count == 0) return;
+            if (m_count == 0 || other.m_min < m_min) m_min = other.m_min;
+            if (m_count == 0 || m_max < other.m_max) m_max = other.m_max;
+            if (m_levels.size() < other.m_levels.size()) {
+                m_levels.resize(other.m_levels.size());
+                m_capacity = capacity();
+            }
+            for (size_t h = 0; h < other.m_levels.size(); ++h) {
+                m_levels[h].insert(m_levels[h].end(), other.m_levels[h].begin(), other.m_levels[h].end());
+            }
+            m_count += other.m_count;
+            m_size += other.m_size;
+            while (m_size >= m_capacity) { compact(); }
+        }
+
+        uint64_t count() const { return m_count; }
+        // Value whose rank is about q * count(); q = 0 and q = 1 return the exact min and max.
+        double quantile(double q) const { return quantiles({ q })[0]; }
+        std::vector<double> quantiles(const std::vector<double>& qs) const {
+            if (m_count == 0) { throw std::runtime_error("quantile of an empty KllSketch."); }
+            std::vector<std::pair<double, uint64_t>> items;
+            items.reserve(m_size);
+            for (size_t h = 0; h < m_levels.size(); ++h) {
+                for (double value : m_levels[h]) { items.emplace_back(value, uint64_t{ 1 } << h); }
+            }
+            std::sort(items.begin(), items.end());
+            std::vector<double> result;
+            result.reserve(qs.size());
+            for (double q : qs) {
+                if (!(q >= 0.0 && q <= 1.0)) { throw std::runtime_error("quantile must be in [0, 1]."); }
+                if (q == 0.0) { result.push_back(m_min); continue; }
+                if (q == 1.0) { result.push_back(m_max); continue; }
+                double rank = q * static_cast<double>(m_count);
+                uint64_t seen = 0;
+                double value = m_max;
+                for (const auto& item : items) {
+                    seen += item.second;
+                    if (static_cast<double>(seen) >= rank) { value = item.first; break; }
+                }
+                result.push_back(value);
+            }
+            return result;
+        }
+
+    private:
+        size_t levelCapacity(size_t level) const {
+            double depth = static_cast<double>(m_levels.size() - level - 1);
+            return (std::max)(size_t{ 2 }, static_cast<size_t>(std::ceil(static_cast<double>(m_k) * std::pow(2.0 / 3.0, depth))));
+        }
+        size_t capacity() const {
+            size_t total = 0;
+            for (size_t h = 0; h < m_levels.size(); ++h) { total += levelCapacity(h); }
+            return total;
+        }
+        // Halves the lowest full level. An odd item out (the smallest) stays behind.
+        void compact() {
+            size_t h = 0;
+            while (m_levels[h].size() < levelCapacity(h)) { ++h; }
+            if (h + 1 == m_levels.size()) {
+                m_levels.emplace_back();
+                m_capacity = capacity();
+            }
+            auto& level = m_levels[h];
+            std::sort(level.begin(), level.end());
+            size_t start = level.size() % 2;
+            m_random ^= m_random << 13;
+            m_random ^= m_random >> 7;
+            m_random ^= m_random << 17;
+            for (size_t i = start + (m_random & 1); i < level.size(); i += 2) { m_levels[h + 1].push_back(level[i]); }
+            m_size -= level.size() - start;
+            m_size += (level.size() - start) / 2;
+            level.resize(start);
+        }
+
+        size_t m_k;
+        std::vector<std::vector<double>> m_levels;
+        uint64_t m_count = 0;
+        size_t m_size = 0;
+        size_t m_capacity = 0;
+        double m_min = 0.0;
+        double m_max = 0.0;
+        uint64_t m_random = 0x9e3779b97f4a7c15ull;
+    };
+
+    namespace detail {
+        // Key of the single group in an ungrouped MaterializedView.
+        struct NoKey {
+            bool operator<(const NoKey&) const { return false; }
+        };
+    } // namespace detail
+
+    // Aggregates of a query's result kept up to date by applying row deltas, so a refresh costs
+    // O(delta * log n) instead of re-running the query. Built by DmLinq::materialize() or
+    // materializeBy() on a from() source filtered only by where(); deltas are source rows and are
+    // run through those predicates before being applied.
+    template <typename T, typename TValue, typename TKey = detail::NoKey>
+    class MaterializedView {
+    public:
+        MaterializedView(std::function<bool(const T&)> accepts, std::function<TKey(const T&)> key_selector, std::function<TValue(const T&)> value_selector)
+            : m_accepts(std::move(accepts)), m_key_selector(std::move(key_selector)), m_value_selector(std::move(value_selector)) {}
+
+        void insert(const T& row);
+        // Throws if the row passes the view's filters but is not part of it.
+        void erase(const T& row);
+        void update(const T& before, const T& after) { erase(before); insert(after); }
+
+        const ViewAggregates<TValue>& totals() const { return m_totals; }
+        size_t count() const { return m_totals.count(); }
+        TValue sum() const { return m_totals.sum(); }
+        double average() const { return m_totals.average(); }
+        std::optional<TValue> min() const { return m_totals.min(); }
+        std::optional<TValue> max() const { return m_totals.max(); }
+
+        // Per-group aggregates of a materializeBy() view; a group disappears when its last row is erased.
+        const std::map<TKey, ViewAggregates<TValue>>& groups() const { return m_groups; }
+        const ViewAggregates<TValue>* group(const TKey& key) const {
+            auto it = m_groups.find(key);
+            return it == m_groups.end() ? nullptr : &it->second;
+        }
+
+    private:
+        static constexpr bool kGrouped = !std::is_same_v<TKey, detail::NoKey>;
+
+        std::function<bool(const T&)> m_accepts;
+        std::function<TKey(const T&)> m_key_selector;
+        std::function<TValue(const T&)> m_value_selector;
+        ViewAggregates<TValue> m_totals;
+        std::map<TKey, ViewAggregates<TValue>> m_groups;
+    };
+
+    // Binary encoding used when a query spills intermediate data to temp files.
+    // Trivially copyable types are handled out of the box; specialize SpillCodec<T>
+    // with bytes/write/read for any other element type that should be spillable.
+    template <typename T, typename Enable = void>
+    struct SpillCodec {};
+
+    namespace detail {
+        template <typename T, typename = void>
+        struct is_spillable : std::false_type {};
+        template <typename T>
+        struct is_spillable<T, std::void_t<decltype(SpillCodec<T>::write(std::declval<std::FILE*>(), std::declval<const T&>()))>> : std::true_type {};
+        template <typename T>
+        inline constexpr bool is_spillable_v = is_spillable<T>::value;
+    } // namespace detail
+
+    template <typename T>
+    struct SpillCodec<T, std::enable_if_t<std::is_trivially_copyable_v<T>>> {
+        static size_t bytes(const T&) { return sizeof(T); }
+        static void write(std::FILE* file, const T& value) {
+            if (std::fwrite(&value, sizeof(T), 1, file) != 1) throw std::runtime_error("Failed to write spill file.");
+        }
+        static bool read(std::FILE* file, T& value) { return std::fread(&value, sizeof(T), 1, file) == 1; }
+    };
+
+    template <typename TChar, typename TTraits, typename TAlloc>
+    struct SpillCodec<std::basic_string<TChar, TTraits, TAlloc>> {
+        using TString = std::basic_string<TChar, TTraits, TAlloc>;
+        static size_t bytes(const TString& value) { return sizeof(TString) + value.capacity() * sizeof(TChar); }
+        static void write(std::FILE* file, const TString& value) {
+            SpillCodec<size_t>::write(file, value.size());
+            if (!value.empty() && std::fwrite(value.data(), sizeof(TChar), value.size(), file) != value.size()) {
+                throw std::runtime_error("Failed to write spill file.");
+            }
+        }
+        static bool read(std::FILE* file, TString& value) {
+            size_t length = 0;
+            if (!SpillCodec<size_t>::read(file, length)) return false;
+            value.resize(length);
+            return length == 0 || std::fread(&value[0], sizeof(TChar), length, file) == length;
+        }
+    };
+
+    template <typename TFirst, typename TSecond>
+    struct SpillCodec<std::pair<TFirst, TSecond>, std::enable_if_t<!std::is_trivially_copyable_v<std::pair<TFirst, TSecond>> &&
+        detail::is_spillable_v<TFirst> && detail::is_spillable_v<TSecond>>> {
+        using TPair = std::pair<TFirst, TSecond>;
+        static size_t bytes(const TPair& value) { return SpillCodec<TFirst>::bytes(value.first) + SpillCodec<TSecond>::bytes(value.second); }
+        static void write(std::FILE* file, const TPair& value) {
+            SpillCodec<TFirst>::write(file, value.first);
+            SpillCodec<TSecond>::write(file, value.second);
+        }
+        static bool read(std::FILE* file, TPair& value) {
+            return SpillCodec<TFirst>::read(file, value.first) && SpillCodec<TSecond>::read(file, value.second);
+        }
+    };
+
+    namespace detail {
+        // Anonymous temp file (removed by the OS on close) holding one spilled run or partition.
+        class SpillFile {
+        public:
+            SpillFile() : m_file(std::tmpfile()) {
+                if (!m_file) throw std::runtime_error("Failed to create spill file.");
+            }
+            SpillFile(SpillFile&& other) noexcept : m_file(other.m_file) { other.m_file = nullptr; }
+            SpillFile& operator=(SpillFile&& other) noexcept { std::swap(m_file, other.m_file); return *this; }
+            SpillFile(const SpillFile&) = delete;
+            SpillFile& operator=(const SpillFile&) = delete;
+            ~SpillFile() { if (m_file) std::fclose(m_file); }
+
+            template <typename T> void write(const T& value) { SpillCodec<T>::write(m_file, value); }
+            template <typename T> bool read(T& value) { return SpillCodec<T>::read(m_file, value); }
+            void rewind() { std::fflush(m_file); std::rewind(m_file); }
+
+        private:
+            std::FILE* m_file;
+        };
+
+        // Grace-hash parameters used by groupBy/aggregateBy/join under a memory limit.
+        inline constexpr size_t kSpillFanout = 16;
+        inline constexpr size_t kSpillMaxDepth = 4;
+        inline constexpr size_t kHashEntryOverhead = 64;
+
+        template <typename T>
+        size_t approxBytes(const T& value) {
+            if constexpr (is_spillable_v<T>) { return SpillCodec<T>::bytes(value); }
+            else { return sizeof(T); }
+        }
+
+        // Each recursion level re-seeds the hash so a partition that is still too large splits differently.
+        template <typename TKey>
+        size_t partitionOf(const TKey& key, size_t depth) {
+            uint64_t h = static_cast<uint64_t>(std::hash<TKey>{}(key)) + 0x9e3779b97f4a7c15ull * (depth + 1);
+            h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+            h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+            h ^= h >> 31;
+            return static_cast<size_t>(h % kSpillFanout);
+        }
+
+        template <typename T, typename TKeyFunc>
+        void spillRow(std::vector<SpillFile>& partitions, const TKeyFunc& key_of, size_t depth, const T& row) {
+            partitions[partitionOf(key_of(row), depth)].write(row);
+        }
+
+        template <typename T, typename TKeyFunc>
+        std::vector<SpillFile> spillPartitions(std::pmr::vector<T>& rows, const TKeyFunc& key_of, size_t depth) {
+            std::vector<SpillFile> partitions(kSpillFanout);
+            for (const auto& row : rows) { spillRow(partitions, key_of, depth, row); }
+            std::pmr::vector<T>(rows.get_allocator()).swap(rows);
+            for (auto& partition : partitions) { partition.rewind(); }
+            return partitions;
+        }
+
+        template <typename T>
+        std::pmr::vector<T> loadPartition(SpillFile& file, std::pmr::memory_resource* resource) {
+            std::pmr::vector<T> rows(resource);
+            T row{};
+            while (file.read(row)) { rows.push_back(std::move(row)); }
+            return rows;
+        }
+
+        // Pulls the rows of a rewound spill file back one at a time.
+        template <typename T>
+        class SpillReader {
+        public:
+            explicit SpillReader(SpillFile& file) : m_file(&file) {}
+            const T* operator()() { return m_file->read(m_row) ? &m_row : nullptr; }
+
+        private:
+            SpillFile* m_file;
+            T m_row{};
+        };
+
+        // Streaming grace hash for groupBy/aggregateBy. Rows pulled from next_row (nullptr at the end)
+        // go to add(row, limit), which returns false, without taking the row, when its table cannot
+        // hold it within limit bytes. The first refusal calls overflow(spill) so the table can hand
+        // rows it must not keep to spill(row); the refused row and every later refused one are then
+        // hash-partitioned into spill files as they arrive. flush() emits the table and resets it, and
+        // each partition is streamed back through the same table one level deeper; past
+        // kSpillMaxDepth (heavy key skew) the budget is lifted. The input is never held as a whole.
+        template <typename T, typename TPull, typename TKeyFunc, typename TAdd, typename TOverflow, typename TFlush>
+        void graceHashStream(TPull next_row, const TKeyFunc& key_of, size_t budget, size_t depth,
+            const TAdd& add, const TOverflow& overflow, const TFlush& flush) {
+            size_t limit = depth < kSpillMaxDepth ? budget : (std::numeric_limits<size_t>::max)();
+            std::vector<SpillFile> partitions;
+            while (const T* row = next_row()) {
+                if (add(*row, limit)) continue;
+                if (partitions.empty()) {
+                    partitions.resize(kSpillFanout);
+                    overflow([&](const T& spilled) { spillRow(partitions, key_of, depth, spilled); });
+                }
+                spillRow(partitions, key_of, depth, *row);
+            }
+            flush();
+            for (auto& partition : partitions) {
+                partition.rewind();
+                graceHashStream<T>(SpillReader<T>(partition), key_of, budget, depth + 1, add, overflow, flush);
+            }
+        }
+
+        // Two-sided variant for joins: both inputs are partitioned with the same hash so matching keys
+        // always meet in the same partition pair.
+        template <typename TOuter, typename TInner, typename TOuterKeyFunc, typename TInnerKeyFunc, typename TBuild>
+        void graceHashJoin(std::pmr::vector<TOuter>& outer, std::pmr::vector<TInner>& inner, const TOuterKeyFunc& outer_key_of,
+            const TInnerKeyFunc& inner_key_of, size_t budget, size_t depth, const TBuild& build) {
+            size_t limit = depth < kSpillMaxDepth ? budget : (std::numeric_limits<size_t>::max)();
+            if (build(outer, inner, limit)) return;
+            auto resource = outer.get_allocator().resource();
+            auto outer_partitions = spillPartitions(outer, outer_key_of, depth);
+            auto inner_partitions = spillPartitions(inner, inner_key_of, depth);
+            for (size_t i = 0; i < kSpillFanout; ++i) {
+                auto outer_rows = loadPartition<TOuter>(outer_partitions[i], resource);
+                if (outer_rows.empty()) continue;
+                auto inner_rows = loadPartition<TInner>(inner_partitions[i], resource);
+                if (inner_rows.empty()) continue;
+                graceHashJoin(outer_rows, inner_rows, outer_key_of, inner_key_of, budget, depth + 1, build);
+            }
+        }
+
+        // Planner heuristics shared by execute() and explain().
+        inline constexpr double kFilterSelectivity = 1.0 / 3.0;
+        inline bool preferTopK(size_t k, size_t rows) { return k < rows / 4; }
+
+        inline PlanNode planOver(std::string op, std::string algorithm, PlanNode child, std::optional<size_t> rows, bool materializes) {
+            PlanNode node{ std::move(op), std::move(algorithm), rows, materializes, {} };
+            node.children.push_back(std::move(child));
+            return node;
+        }
+
+        // Stable top-k: partial sort over row indices (index breaks ties), then keep the first k rows.
+        template <typename T, typename TCompare>
+        void stableTopK(std::pmr::vector<T>& items, size_t k, const TCompare& compare) {
+            auto resource = items.get_allocator().resource();
+            std::pmr::vector<size_t> order(items.size(), resource);
+            std::iota(order.begin(), order.end(), size_t{ 0 });
+            k = (std::min)(k, items.size());
+            std::partial_sort(order.begin(), order.begin() + k, order.end(), [&](size_t a, size_t b) {
+                if (compare(items[a], items[b])) return true;
+                if (compare(items[b], items[a])) return false;
+                return a < b;
+                });
+            std::pmr::vector<T> top(resource);
+            top.reserve(k);
+            for (size_t i = 0; i < k; ++i) { top.push_back(std::move(items[order[i]])); }
+            items.swap(top);
+        }
+
+        // Stable sort whose scratch space comes from `resource`. std::stable_sort allocates its
+        // temporary buffer with operator new, so it is only used when no arena is attached.
+        template <typename T, typename TCompare>
+        void stableSort(std::pmr::vector<T>& items, const TCompare& compare) {
+            auto resource = items.get_allocator().resource();
+            if (resource == std::pmr::get_default_resource()) { std::stable_sort(items.begin(), items.end(), compare); return; }
+            constexpr size_t kRunLength = 32;
+            size_t n = items.size();
+            for (size_t lo = 0; lo < n; lo += kRunLength) {
+                size_t hi = (std::min)(n, lo + kRunLength);
+                for (size_t i = lo + 1; i < hi; ++i) {
+                    auto pos = std::upper_bound(items.begin() + lo, items.begin() + i, items[i], compare);
+                    std::rotate(pos, items.begin() + i, items.begin() + i + 1);
+                }
+            }
+            std::pmr::vector<T> scratch(resource);
+            scratch.reserve(n);
+            for (size_t width = kRunLength; width < n; width *= 2) {
+                for (size_t lo = 0; lo + width < n; lo += 2 * width) {
+                    auto first = items.begin() + lo;
+                    auto middle = first + width;
+                    auto last = items.begin() + (std::min)(n, lo + 2 * width);
+                    scratch.clear();
+                    std::merge(std::make_move_iterator(first), std::make_move_iterator(middle),
+                        std::make_move_iterator(middle), std::make_move_iterator(last), std::back_inserter(scratch), compare);
+                    std::move(scratch.begin(), scratch.end(), first);
+                }
+            }
+        }
+
+        // Bloom filter made of 512-bit blocks. The high half of the hash picks a block and the low
+        // half sets one bit in each of its eight words, so a probe touches a single cache line.
+        // At 16 bits per key the false positive rate stays well under 1%.
+        class BlockedBloomFilter {
+        public:
+            BlockedBloomFilter(size_t expected_keys, std::pmr::memory_resource* resource)
+                : m_blocks((std::max)(size_t{ 1 }, (expected_keys * kBitsPerKey + 511) / 512), Block{}, resource) {}
+
+            void insert(uint64_t hash) {
+                auto& block = blockOf(hash);
+                for (size_t i = 0; i < 8; ++i) { block.words[i] |= bitOf(hash, i); }
+            }
+            bool mayContain(uint64_t hash) const {
+                const auto& block = blockOf(hash);
+                for (size_t i = 0; i < 8; ++i) {
+                    if ((block.words[i] & bitOf(hash, i)) == 0) return false;
+                }
+                return true;
+            }
+            size_t blockCount() const { return m_blocks.size(); }
+
+        private:
+            static constexpr size_t kBitsPerKey = 16;
+            struct alignas(64) Block { uint64_t words[8] = {}; };
+
+            static uint64_t bitOf(uint64_t hash, size_t word) {
+                static constexpr uint32_t kSalt[8] = { 0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du,
+                                                       0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u };
+                uint32_t lo = static_cast<uint32_t>(hash) * kSalt[word];
+                return uint64_t{ 1 } << (lo >> 26);
+            }
+            const Block& blockOf(uint64_t hash) const { return m_blocks[static_cast<size_t>(((hash >> 32) * m_blocks.size()) >> 32)]; }
+            Block& blockOf(uint64_t hash) { return m_blocks[static_cast<size_t>(((hash >> 32) * m_blocks.size()) >> 32)]; }
+
+            std::pmr::vector<Block> m_blocks;
+        };
+
+        // NUMA placement used by parallel scans. Built with DMLINQ_ENABLE_NUMA it asks libnuma
+        // where a page lives and pins threads to a node; otherwise, or when the kernel has no NUMA
+        // support, the machine is treated as a single node and both calls do nothing.
+        struct NumaTopology {
+            static size_t nodeCount() {
+#if defined(DMLINQ_ENABLE_NUMA)
+                static const size_t nodes = numa_available() < 0 ? 1 : static_cast<size_t>(numa_max_node()) + 1;
+                return nodes;
+#else
+                return 1;
+#endif
+            }
+            static size_t nodeOf(const void* address) {
+#if defined(DMLINQ_ENABLE_NUMA)
+                if (nodeCount() > 1) {
+                    int node = -1;
+                    if (get_mempolicy(&node, nullptr, 0, const_cast<void*>(address), MPOL_F_NODE | MPOL_F_ADDR) == 0 && node >= 0) {
+                        return static_cast<size_t>(node) % nodeCount();
+                    }
+                }
+#endif
+                (void)address;
+                return 0;
+            }
+
+            // Pins the calling thread to the CPUs of `node`, which also makes its first-touch
+            // allocations land there, and gives the thread back its previous affinity when destroyed.
+            class ThreadBinding {
+            public:
+                explicit ThreadBinding(size_t node) {
+#if defined(DMLINQ_ENABLE_NUMA)
+                    if (nodeCount() > 1) {
+                        m_saved = numa_allocate_cpumask();
+                        if (numa_sched_getaffinity(0, m_saved) < 0) {
+                            numa_free_cpumask(m_saved);
+                            m_saved = nullptr;
+                            return;
+                        }
+                        numa_run_on_node(static_cast<int>(node));
+                    }
+#endif
+                    (void)node;
+                }
+                ~ThreadBinding() {
+#if defined(DMLINQ_ENABLE_NUMA)
+                    if (m_saved) {
+                        numa_sched_setaffinity(0, m_saved);
+                        numa_free_cpumask(m_saved);
+                    }
+#endif
+                }
+                ThreadBinding(const ThreadBinding&) = delete;
+                ThreadBinding& operator=(const ThreadBinding&) = delete;
+
+            private:
+#if defined(DMLINQ_ENABLE_NUMA)
+                struct bitmask* m_saved = nullptr;
+#endif
+            };
+        };
+
+        struct Morsel { size_t begin; size_t end; };
+
+        // Runs work(worker, next) on `workers` threads, the caller being worker 0. Worker w is bound
+        // to node w % nodes for the duration of the call and next() hands it the morsels queued on
+        // that node first, then steals from the other nodes once its own queue is empty. Once a worker
+        // throws the others take no further morsels, and the first exception is rethrown. Threads are
+        // started per call rather than pooled, which costs some tens of microseconds per worker;
+        // callers only come here with at least two morsels.
+        template <typename TWork>
+        void runMorsels(const std::vector<std::vector<Morsel>>& by_node, size_t workers, TWork work) {
+            struct alignas(64) Queue { std::atomic<size_t> next{ 0 }; };
+            std::vector<Queue> queues(by_node.size());
+            std::vector<std::exception_ptr> errors(workers);
+            std::atomic<bool> failed{ false };
+            auto run = [&](size_t worker) {
+                size_t home = worker % by_node.size();
+                NumaTopology::ThreadBinding binding(home);
+                auto next = [&, home, node = size_t{ 0 }]() mutable -> const Morsel* {
+                    if (failed.load(std::memory_order_relaxed)) { return nullptr; }
+                    for (; node < by_node.size(); ++node) {
+                        size_t queue = (home + node) % by_node.size();
+                        size_t index = queues[queue].next.fetch_add(1, std::memory_order_relaxed);
+                        if (index < by_node[queue].size()) { return &by_node[queue][index]; }
+                    }
+                    return nullptr;
+                    };
+                try { work(worker, next); }
+                catch (...) {
+                    errors[worker] = std::current_exception();
+                    failed.store(true, std::memory_order_relaxed);
+                }
+                };
+            std::vector<std::thread> threads;
+            threads.reserve(workers - 1);
+            for (size_t worker = 1; worker < workers; ++worker) { threads.emplace_back(run, worker); }
+            run(0);
+            for (auto& thread : threads) { thread.join(); }
+            for (const auto& error : errors) {
+                if (error) { std::rethrow_exception(error); }
+            }
+        }
+    } // namespace detail
+
+    template <typename T>
+    class DmLinq {
+    public:
+        // Buffer type handed between pipeline stages; allocated from the query's memory resource.
+        using Buffer = std::pmr::vector<T>;
+        using SourceProvider = std::function<Buffer(const detail::ExecutionContext&)>;
+        using CursorProvider = std::function<std::unique_ptr<detail::Cursor<T>>(const detail::ExecutionContext&)>;
+
+        // Internal use for chaining
+        DmLinq(std::shared_ptr<void> previous_stage, SourceProvider source_provider);
+        // Internal use for pull-based sources
+        DmLinq(CursorProvider cursor_provider, std::function<PlanNode()> input_plan);
+
+    private:
+        template <typename> friend class DmLinq;
+        friend DmLinq<T> from<T>(const std::vector<T>& source);
+        friend DmLinq<T> from<T>(std::vector<T>&& source);
+        friend DmLinq<T> from<T>(const IndexedVector<T>& table);
+        DmLinq(std::shared_ptr<std::vector<T>> source);
+
+        // Pipeline components
+        std::shared_ptr<void> m_previous_stage;
+        SourceProvider m_source_provider;
+        detail::SmallVector<InlineFunction<bool(const T&)>, 6> m_filters;
+        detail::KeyComparator<T> m_sorter;
+        size_t m_skip_count = 0;
+        std::optional<size_t> m_take_count;
+        std::optional<size_t> m_memory_limit;
+        std::pmr::memory_resource* m_resource = nullptr;
+        QueryProfile* m_profile = nullptr;
+        std::shared_ptr<const QueryLimits> m_limits;
+        size_t m_parallelism = 1;
+        std::function<PlanNode()> m_input_plan;
+        CursorProvider m_cursor_provider; // set when the input can be pulled row by row
+        const std::vector<T>* m_source_rows = nullptr; // identity of a from() source, for whereIndexed()
+        std::shared_ptr<const detail::RowRanges> m_source_ranges; // rows left after index probes; null = all
+
+        void bindSource(std::shared_ptr<std::vector<T>> source, std::shared_ptr<const detail::RowRanges> ranges, std::string method = "index probe");
+        void narrowSource(const std::shared_ptr<std::vector<T>>& rows, detail::RowRanges ranges, const char* method);
+
+        std::pmr::memory_resource* executionResource() const { return m_resource ? m_resource : std::pmr::get_default_resource(); }
+        std::string sortAlgorithm() const;
+        std::shared_ptr<DmLinq<T>> snapshot() const;
+        template <typename TResult, typename TProvider> DmLinq<TResult> chain(std::shared_ptr<void> self, TProvider provider, std::function<PlanNode()> input_plan) const;
+        detail::ExecutionContext topLevelContext(bool consume_source, detail::QueryGuard& guard) const;
+        Buffer execute(detail::QueryGuard& guard, bool consume_source = false) const;
+        Buffer execute(const detail::ExecutionContext& ctx) const;
+        template <typename TVisit> void forEachRow(TVisit visit) const;
+        template <typename TPull> Buffer externalSort(TPull next_row, const detail::ExecutionContext& ctx) const;
+        std::unique_ptr<detail::Cursor<T>> openInput(const detail::ExecutionContext& ctx) const;
+        std::unique_ptr<detail::Cursor<T>> openCursor(const detail::ExecutionContext& ctx) const;
+        template <typename TCompare> DmLinq<T> rollingExtreme(size_t size, TCompare compare, const char* op) const;
+        template <typename TInner, typename TOuterKeyFunc, typename TInnerKeyFunc>
+        DmLinq<T> membershipJoin(const DmLinq<TInner>& inner, TOuterKeyFunc outer_key_selector, TInnerKeyFunc inner_key_selector, bool keep_matches) const;
+        template <typename TResult, typename TCursorProvider> DmLinq<TResult> chainStreaming(std::shared_ptr<void> self, TCursorProvider cursor_provider, std::function<PlanNode()> input_plan) const;
+        template <typename TAcc, typename TAccumulate, typename TMerge>
+        std::optional<TAcc> parallelFold(const TAcc& seed, const TAccumulate& accumulate, const TMerge& merge) const;
+
+    public:
+        // Operators never modify a query that is still referenced elsewhere: called on a named query
+        // they return a modified copy, called on a temporary they reuse it. A query can therefore be
+        // shared by threads that each derive from and run it, provided no arena or profile is attached.
+        template<typename TFunc> [[nodiscard]] DmLinq<T> where(TFunc predicate) const&;
+        template<typename TFunc> [[nodiscard]] DmLinq<T> where(TFunc predicate) &&;
+        // Index probes; the query must start with from() on the table that owns the index.
+        template <typename TKey> [[nodiscard]] DmLinq<T> whereIndexed(const HashIndex<T, TKey>& index, const detail::TypeIdentityT<TKey>& key) const&;
+        template <typename TKey> [[nodiscard]] DmLinq<T> whereIndexed(const HashIndex<T, TKey>& index, const detail::TypeIdentityT<TKey>& key) &&;
+        template <typename TKey> [[nodiscard]] DmLinq<T> whereIndexed(const OrderedIndex<T, TKey>& index, const detail::TypeIdentityT<TKey>& lo, const detail::TypeIdentityT<TKey>& hi) const&;
+        template <typename TKey> [[nodiscard]] DmLinq<T> whereIndexed(const OrderedIndex<T, TKey>& index, const detail::TypeIdentityT<TKey>& lo, const detail::TypeIdentityT<TKey>& hi) &&;
+        // Keeps rows with lo <= key <= hi. With a ZoneMap of the source, blocks that cannot match are skipped.
+        template <typename TKey> [[nodiscard]] DmLinq<T> whereBetween(const ZoneMap<T, TKey>& zones, const detail::TypeIdentityT<TKey>& lo, const detail::TypeIdentityT<TKey>& hi) const&;
+        template <typename TKey> [[nodiscard]] DmLinq<T> whereBetween(const ZoneMap<T, TKey>& zones, const detail::TypeIdentityT<TKey>& lo, const detail::TypeIdentityT<TKey>& hi) &&;
+        template <typename TFunc, typename TKey, std::enable_if_t<std::is_invocable_v<TFunc, const T&>, int> = 0>
+        [[nodiscard]] DmLinq<T> whereBetween(TFunc key_selector, const TKey& lo, const TKey& hi) const&;
+        template <typename TFunc, typename TKey, std::enable_if_t<std::is_invocable_v<TFunc, const T&>, int> = 0>
+        [[nodiscard]] DmLinq<T> whereBetween(TFunc key_selector, const TKey& lo, const TKey& hi) &&;
+        template <typename TFunc> [[nodiscard]] DmLinq<T> orderBy(TFunc key_selector, SortDirection direction = SortDirection::ASC) const&;
+        template <typename TFunc> [[nodiscard]] DmLinq<T> orderBy(TFunc key_selector, SortDirection direction = SortDirection::ASC) &&;
+        template <typename TFunc> [[nodiscard]] DmLinq<T> orderByDescending(TFunc key_selector) const&;
+        template <typename TFunc> [[nodiscard]] DmLinq<T> orderByDescending(TFunc key_selector) &&;
+        template <typename TFunc> [[nodiscard]] DmLinq<T> thenBy(TFunc key_selector, SortDirection direction = SortDirection::ASC) const&;
+        template <typename TFunc> [[nodiscard]] DmLinq<T> thenBy(TFunc key_selector, SortDirection direction = SortDirection::ASC) &&;
+        template <typename TFunc> [[nodiscard]] DmLinq<T> thenByDescending(TFunc key_selector) const&;
+        template <typename TFunc> [[nodiscard]] DmLinq<T> thenByDescending(TFunc key_selector) &&;
+        template <typename TFunc> [[nodiscard]] auto select(TFunc selector) const -> DmLinq<std::invoke_result_t<TFunc, const T&>>;
+        template <typename TFunc> [[nodiscard]] auto selectMany(TFunc selector) const -> DmLinq<typename std::invoke_result_t<TFunc, const T&>::value_type>;
+        template <typename TFunc> [[nodiscard]] auto groupBy(TFunc key_selector) const -> DmLinq<std::pair<std::decay_t<std::invoke_result_t<TFunc, const T&>>, std::vector<T>>>;
+        template <typename TKeyFunc, typename TAcc, typename TFoldFunc>
+        [[nodiscard]] auto aggregateBy(TKeyFunc key_selector, TAcc seed, TFoldFunc fold) const -> DmLinq<std::pair<std::decay_t<std::invoke_result_t<TKeyFunc, const T&>>, TAcc>>;
+        // (key, occurrences) per distinct key, in order of first appearance.
+        template <typename TFunc> [[nodiscard]] auto countBy(TFunc key_selector) const -> DmLinq<std::pair<std::decay_t<std::invoke_result_t<TFunc, const T&>>, size_t>>;
+        template <typename TInner, typename TOuterKeyFunc, typename TInnerKeyFunc, typename TResultFunc>
+        [[nodiscard]] auto join(const DmLinq<TInner>& inner, TOuterKeyFunc outer_key_selector, TInnerKeyFunc inner_key_selector, TResultFunc result_selector) const
+            -> DmLinq<std::invoke_result_t<TResultFunc, const T&, const TInner&>>;
+        // Rows with (semiJoin) or without (antiJoin) a key match in `inner`; each row is emitted at most once.
+        template <typename TInner, typename TOuterKeyFunc, typename TInnerKeyFunc>
+        [[nodiscard]] DmLinq<T> semiJoin(const DmLinq<TInner>& inner, TOuterKeyFunc outer_key_selector, TInnerKeyFunc inner_key_selector) const;
+        template <typename TInner, typename TOuterKeyFunc, typename TInnerKeyFunc>
+        [[nodiscard]] DmLinq<T> antiJoin(const DmLinq<TInner>& inner, TOuterKeyFunc outer_key_selector, TInnerKeyFunc inner_key_selector) const;
+        template <typename TKey, typename TFunc> [[nodiscard]] DmLinq<T> whereIn(const DmLinq<TKey>& keys, TFunc key_selector) const;
+        [[nodiscard]] DmLinq<T> take(size_t count) const&;
+        [[nodiscard]] DmLinq<T> take(size_t count) &&;
+        [[nodiscard]] DmLinq<T> skip(size_t count) const&;
+        [[nodiscard]] DmLinq<T> skip(size_t count) &&;
+        template <typename TFunc> [[nodiscard]] DmLinq<T> takeWhile(TFunc predicate) const;
+        template <typename TFunc> [[nodiscard]] DmLinq<T> skipWhile(TFunc predicate) const;
+        [[nodiscard]] DmLinq<std::vector<T>> chunk(size_t size) const;
+        [[nodiscard]] DmLinq<std::vector<T>> window(size_t size, size_t step = 1) const;
+        template <typename TAcc, typename TAddFunc, typename TRemoveFunc>
+        [[nodiscard]] DmLinq<TAcc> rollingFold(size_t size, TAcc seed, TAddFunc add, TRemoveFunc remove) const;
+        template <typename TFunc = detail::Identity> [[nodiscard]] auto rollingSum(size_t size, TFunc selector = TFunc{}) const -> DmLinq<std::invoke_result_t<TFunc, const T&>>;
+        template <typename TFunc = detail::Identity> [[nodiscard]] DmLinq<double> rollingAvg(size_t size, TFunc selector = TFunc{}) const;
+        template <typename TFunc = detail::Identity> [[nodiscard]] auto rollingMin(size_t size, TFunc selector = TFunc{}) const -> DmLinq<std::invoke_result_t<TFunc, const T&>>;
+        template <typename TOther, typename TFunc>
+        [[nodiscard]] auto zip(const DmLinq<TOther>& other, TFunc result_selector) const -> DmLinq<std::invoke_result_t<TFunc, const T&, const TOther&>>;
+        [[nodiscard]] DmLinq<T> concat(const DmLinq<T>& other) const;
+        template <typename TFunc> [[nodiscard]] DmLinq<T> mergeSorted(const DmLinq<T>& other, TFunc key_selector) const;
+        template <typename TFunc = detail::Identity> [[nodiscard]] auto rollingMax(size_t size, TFunc selector = TFunc{}) const -> DmLinq<std::invoke_result_t<TFunc, const T&>>;
+        // Random subsets, returned in input order. The same seed over the same input gives the same sample.
+        [[nodiscard]] DmLinq<T> sample(size_t count, uint64_t seed = 0) const;
+        [[nodiscard]] DmLinq<T> sampleFraction(double fraction, uint64_t seed = 0) const;
+        template <typename TFunc> [[nodiscard]] DmLinq<T> sampleBy(TFunc key_selector, size_t count_per_key, uint64_t seed = 0) const;
+        [[nodiscard]] DmLinq<T> withMemoryLimit(size_t bytes) const&;
+        [[nodiscard]] DmLinq<T> withMemoryLimit(size_t bytes) &&;
+        // The arena or resource must outlive the returned query and everything derived from it.
+        [[nodiscard]] DmLinq<T> withArena(QueryArena& arena) const&;
+        [[nodiscard]] DmLinq<T> withArena(QueryArena& arena) &&;
+        [[nodiscard]] DmLinq<T> withArena(std::pmr::memory_resource* resource) const&;
+        [[nodiscard]] DmLinq<T> withArena(std::pmr::memory_resource* resource) &&;
+        [[nodiscard]] PlanNode explain() const;
+        [[nodiscard]] DmLinq<T> withProfiling(QueryProfile& profile) const&;
+        [[nodiscard]] DmLinq<T> withProfiling(QueryProfile& profile) &&;
+        // Terminals throw QueryCancelled once a limit is hit; tryToVector() returns the rows produced so far instead.
+        [[nodiscard]] DmLinq<T> withLimits(QueryLimits limits) const&;
+        [[nodiscard]] DmLinq<T> withLimits(QueryLimits limits) &&;
+        // Aggregating terminals scan a from() source on up to `workers` threads (0 = one per hardware
+        // thread), in morsels placed by NUMA node. Each call starts its own threads, so this pays off
+        // on large inputs only. Queries with a stage, sort or take/skip run serially.
+        [[nodiscard]] DmLinq<T> withParallelism(size_t workers = 0) const&;
+        [[nodiscard]] DmLinq<T> withParallelism(size_t workers = 0) &&;
+        T first() const;
+        template<typename TFunc> T first(TFunc predicate) const;
+        std::optional<T> firstOrDefault() const;
+        template<typename TFunc> std::optional<T> firstOrDefault(TFunc predicate) const;
+        T last() const;
+        template<typename TFunc> T last(TFunc predicate) const;
+        std::optional<T> lastOrDefault() const;
+        template<typename TFunc> std::optional<T> lastOrDefault(TFunc predicate) const;
+        T single() const;
+        template<typename TFunc> T single(TFunc predicate) const;
+        std::optional<T> singleOrDefault() const;
+        template<typename TFunc> std::optional<T> singleOrDefault(TFunc predicate) const;
+        size_t count() const;
+        template<typename TFunc> size_t count(TFunc predicate) const;
+        template<typename TFunc> auto sum(TFunc selector) const -> std::invoke_result_t<TFunc, const T&>;
+        auto sum() const -> T;
+        template<typename TFunc> double average(TFunc selector) const;
+        double average() const;
+        T max() const;
+        T min() const;
+        // fold(acc, row) -> acc; with withParallelism() each worker folds from a copy of `seed` and the
+        // partial results are joined with combine(acc, acc) -> acc, which must be associative.
+        template <typename TAcc, typename TFoldFunc, typename TCombineFunc> TAcc aggregate(TAcc seed, TFoldFunc fold, TCombineFunc combine) const;
+        bool any() const;
+        template<typename TFunc> bool any(TFunc predicate) const;
+        template<typename TFunc> bool all(TFunc predicate) const;
+        template <typename TFunc = detail::Identity> size_t countDistinct(TFunc key_selector = TFunc{}) const;
+        template <typename TFunc = detail::Identity> HyperLogLog toHyperLogLog(TFunc key_selector = TFunc{}, uint8_t precision = 14) const;
+        template <typename TFunc = detail::Identity> size_t countDistinctApprox(TFunc key_selector = TFunc{}, uint8_t precision = 14) const;
+        // Exact quantiles by selection, linearly interpolated between the neighbouring ranks.
+        template <typename TFunc = detail::Identity> double quantile(double q, TFunc selector = TFunc{}) const;
+        template <typename TFunc = detail::Identity> std::vector<double> quantiles(const std::vector<double>& qs, TFunc selector = TFunc{}) const;
+        // Approximate quantiles from a KllSketch with parameter k, in bounded memory.
+        template <typename TFunc = detail::Identity> KllSketch toKllSketch(TFunc selector = TFunc{}, size_t k = 200) const;
+        template <typename TFunc = detail::Identity> double quantileApprox(double q, TFunc selector = TFunc{}, size_t k = 200) const;
+        template <typename TFunc = detail::Identity> std::vector<double> quantilesApprox(const std::vector<double>& qs, TFunc selector = TFunc{}, size_t k = 200) const;
+        // The k most frequent keys with their counts, most frequent first; ties keep first-appearance order.
+        template <typename TFunc> auto topFrequent(TFunc key_selector, size_t k) const -> std::vector<std::pair<std::decay_t<std::invoke_result_t<TFunc, const T&>>, size_t>>;
+        // Space-Saving with a fixed number of counters (default max(10k, 1024)); counts are upper bounds.
+        template <typename TFunc> auto topFrequentApprox(TFunc key_selector, size_t k, size_t counters = 0) const -> std::vector<std::pair<std::decay_t<std::invoke_result_t<TFunc, const T&>>, size_t>>;
+        // Over [min, max] of the projected values, or over an explicit [lo, hi].
+        template <typename TFunc> Histogram histogram(TFunc selector, size_t bins) const;
+        template <typename TFunc> Histogram histogram(TFunc selector, size_t bins, double lo, double hi) const;
+        std::vector<T> toVector() const&;
+        std::vector<T> toVector() &&; // may move the elements out of a source passed to from(std::move(v))
+        PartialResult<std::vector<T>> tryToVector() const;
+        [[nodiscard]] AsyncQuery<std::vector<T>> toVectorAsync(size_t batch_size = 1024) const;
+        template <typename TValueFunc>
+        [[nodiscard]] auto materialize(TValueFunc value_selector) const -> MaterializedView<T, std::invoke_result_t<TValueFunc, const T&>>;
+        template <typename TKeyFunc, typename TValueFunc>
+        [[nodiscard]] auto materializeBy(TKeyFunc key_selector, TValueFunc value_selector) const
+            -> MaterializedView<T, std::invoke_result_t<TValueFunc, const T&>, std::decay_t<std::invoke_result_t<TKeyFunc, const T&>>>;
+        template <typename TFunc> [[nodiscard]] AsyncQuery<size_t> forEachAsync(TFunc action, size_t batch_size = 1024) const;
+        std::set<T> toSet() const;
+        template <typename TFunc> auto toMap(TFunc key_selector) const -> std::map<std::invoke_result_t<TFunc, const T&>, T>;
+        template <typename TKeyFunc, typename TValueFunc>
+        auto toMap(TKeyFunc key_selector, TValueFunc value_selector) const -> std::map<std::invoke_result_t<TKeyFunc, const T&>, std::invoke_result_t<TValueFunc, const T&>>;
+    };
+
+    // Typed handle to a named parameter declared on a CompiledQuery.
+    template <typename TValue>
+    struct QueryParam {
+        size_t index;
+    };
+
+    namespace detail {
+        // A parameter declared with CompiledQuery::param<TValue>(name).
+        struct ParamDecl {
+            std::string name;
+            std::type_index type;
+        };
+    } // namespace detail
+
+    // Parameter values for one execution of a CompiledQuery; start from CompiledQuery::bind().
+    // Values must be set with exactly the declared type (e.g. size_t for skip/take parameters);
+    // setting one by name with another type throws right away.
+    class QueryArgs {
+    public:
+        QueryArgs() = default;
+        explicit QueryArgs(std::shared_ptr<const std::vector<detail::ParamDecl>> params) : m_params(std::move(params)), m_values(m_params->size()) {}
+
+        template <typename TValue>
+        QueryArgs& set(QueryParam<TValue> param, TValue value) { m_values.at(param.index) = std::move(value); return *this; }
+        template <typename TValue>
+        QueryArgs& set(const std::string& name, TValue value) {
+            if (m_params) {
+                auto it = std::find_if(m_params->begin(), m_params->end(), [&name](const detail::ParamDecl& param) { return param.name == name; });
+                if (it != m_params->end()) {
+                    if (it->type != std::type_index(typeid(TValue))) {
+                        throw std::runtime_error("Query parameter " + name + " is declared with a different type.");
+                    }
+                    m_values.at(static_cast<size_t>(it - m_params->begin())) = std::move(value);
+                    return *this;
+                }
+            }
+            throw std::runtime_error("Unknown query parameter: " + name);
+        }
+        template <typename TValue>
+        const TValue& get(QueryParam<TValue> param) const {
+            const TValue* value = param.index < m_values.size() ? std::any_cast<TValue>(&m_values[param.index]) : nullptr;
+            if (!value) throw std::runtime_error("Query parameter is unbound or bound with a different type.");
+            return *value;
+        }
+
+    private:
+        std::shared_ptr<const std::vector<detail::ParamDecl>> m_params;
+        std::vector<std::any> m_values;
+    };
+
+    // A query shape built once and executed many times against different sources and parameter
+    // values. execute()/count() are const and keep no per-call state in the plan, so one plan can
+    // be run concurrently from several threads.
+    template <typename T>
+    class CompiledQuery {
+    public:
+        using Predicate = InlineFunction<bool(const T&, const QueryArgs&)>;
+
+        template <typename TValue> [[nodiscard]] QueryParam<TValue> param(const std::string& name);
+        template <typename TFunc> CompiledQuery<T>& where(TFunc predicate);
+        template <typename TFunc> CompiledQuery<T>& orderBy(TFunc key_selector, SortDirection direction = SortDirection::ASC);
+        template <typename TFunc> CompiledQuery<T>& orderByDescending(TFunc key_selector);
+        template <typename TFunc> CompiledQuery<T>& thenBy(TFunc key_selector, SortDirection direction = SortDirection::ASC);
+        template <typename TFunc> CompiledQuery<T>& thenByDescending(TFunc key_selector);
+        CompiledQuery<T>& skip(size_t count);
+        CompiledQuery<T>& skip(QueryParam<size_t> count);
+        CompiledQuery<T>& take(size_t count);
+        CompiledQuery<T>& take(QueryParam<size_t> count);
+
+        [[nodiscard]] QueryArgs bind() const { return QueryArgs(m_params); }
+        std::vector<T> execute(const std::vector<T>& source, const QueryArgs& args = QueryArgs(), std::pmr::memory_resource* resource = nullptr) const;
+        size_t count(const std::vector<T>& source, const QueryArgs& args = QueryArgs()) const;
+
+    private:
+        bool accepts(const T& item, const QueryArgs& args) const;
+
+        std::shared_ptr<std::vector<detail::ParamDecl>> m_params = std::make_shared<std::vector<detail::ParamDecl>>();
+        std::vector<Predicate> m_filters;
+        detail::KeyComparator<T> m_sorter;
+        size_t m_skip_count = 0;
+        std::optional<QueryParam<size_t>> m_skip_param;
+        std::optional<size_t> m_take_count;
+        std::optional<QueryParam<size_t>> m_take_param;
+    };
+
+    template <typename T>
+    [[nodiscard]] CompiledQuery<T> compile() { return CompiledQuery<T>(); }
+
+    namespace detail {
+        // Output port of a push stage: every pushed row is handed to each attached downstream stage.
+        template <typename T>
+        class PushFanout {
+        public:
+            void emit(const T& value) const { for (const auto& sink : m_sinks) sink(value); }
+            void attach(std::function<void(const T&)> sink) { m_sinks.push_back(std::move(sink)); }
+
+        private:
+            std::vector<std::function<void(const T&)>> m_sinks;
+        };
+    } // namespace detail
+
+    // Live result of an incremental aggregate over a push query; updated on every arriving row.
+    template <typename TValue>
+    class PushAggregate {
+    public:
+        explicit PushAggregate(std::shared_ptr<TValue> value) : m_value(std::move(value)) {}
+        const TValue& value() const { return *m_value; }
+
+    private:
+        std::shared_ptr<TValue> m_value;
+    };
+
+    // Push mode: the query is built once and rows are pushed through it as they arrive, so each
+    // row costs one pass through the operator chain instead of re-running the query over
+    // everything accumulated so far. Operators return new stages hanging off this one; several
+    // stages and subscribers may share an upstream. Stages only see rows pushed after they were
+    // attached. Not thread-safe: push from one thread at a time.
+    template <typename T>
+    class PushQuery {
+    public:
+        template <typename TFunc> [[nodiscard]] PushQuery<T> where(TFunc predicate) const;
+        template <typename TFunc> [[nodiscard]] auto select(TFunc selector) const -> PushQuery<std::invoke_result_t<TFunc, const T&>>;
+        [[nodiscard]] PushQuery<T> skip(size_t count) const;
+        [[nodiscard]] PushQuery<T> take(size_t count) const;
+        template <typename TFunc> void subscribe(TFunc callback) const;
+
+        [[nodiscard]] PushAggregate<size_t> count() const;
+        template <typename TFunc = detail::Identity> [[nodiscard]] auto sum(TFunc selector = TFunc{}) const -> PushAggregate<std::invoke_result_t<TFunc, const T&>>;
+        template <typename TFunc = detail::Identity> [[nodiscard]] PushAggregate<double> average(TFunc selector = TFunc{}) const;
+        template <typename TFunc = detail::Identity> [[nodiscard]] auto min(TFunc selector = TFunc{}) const -> PushAggregate<std::optional<std::invoke_result_t<TFunc, const T&>>>;
+        template <typename TFunc = detail::Identity> [[nodiscard]] auto max(TFunc selector = TFunc{}) const -> PushAggregate<std::optional<std::invoke_result_t<TFunc, const T&>>>;
+        template <typename TAcc, typename TFoldFunc> [[nodiscard]] PushAggregate<TAcc> aggregate(TAcc seed, TFoldFunc fold) const;
+        template <typename TKeyFunc, typename TAcc, typename TFoldFunc>
+        [[nodiscard]] auto aggregateBy(TKeyFunc key_selector, TAcc seed, TFoldFunc fold) const
+            -> PushAggregate<std::unordered_map<std::decay_t<std::invoke_result_t<TKeyFunc, const T&>>, TAcc>>;
+
+    protected:
+        explicit PushQuery(std::shared_ptr<detail::PushFanout<T>> out) : m_out(std::move(out)) {}
+        template <typename TResult, typename TAttach> PushQuery<TResult> chain(TAttach attach) const;
+
+        std::shared_ptr<detail::PushFanout<T>> m_out;
+
+        template <typename> friend class PushQuery;
+    };
+
+    // Entry point of a push query.
+    template <typename T>
+    class PushSource : public PushQuery<T> {
+    public:
+        PushSource() : PushQuery<T>(std::make_shared<detail::PushFanout<T>>()) {}
+        void push(const T& value) { this->m_out->emit(value); }
+        void pushBatch(const std::vector<T>& values) { for (const auto& value : values) this->m_out->emit(value); }
+    };
+
+    // ===================================================================================
+    // === Inlined Implementations (replaces all .tpp files) =============================
+    // ===================================================================================
+
+    // --- Constructors and Entry Points ---
+    // The source is shared by every stage copied from this one, so copying a query never copies its rows.
+    template<typename T>
+    DmLinq<T>::DmLinq(std::shared_ptr<std::vector<T>> source) {
+        bindSource(std::move(source), nullptr);
+    }
+    template<typename T>
+    void DmLinq<T>::bindSource(std::shared_ptr<std::vector<T>> source, std::shared_ptr<const detail::RowRanges> ranges, std::string method) {
+        m_source_rows = source.get();
+        m_source_ranges = ranges;
+        if (ranges) {
+            size_t selected = detail::rowCount(*ranges);
+            m_source_provider = [source, ranges, selected](const detail::ExecutionContext& ctx) {
+                detail::OperatorScope scope(ctx, "IndexScan", selected);
+                if (ctx.guard) { ctx.guard->scanRows(selected); }
+                Buffer rows(ctx.resource);
+                rows.reserve(selected);
+                for (const auto& range : *ranges) { rows.insert(rows.end(), source->begin() + range.first, source->begin() + range.second); }
+                scope.finish(rows.size(), rows.size() * sizeof(T));
+                return rows;
+                };
+            m_input_plan = [method, selected, total = source->size(), probes = ranges->size()]() {
+                return PlanNode{ "Source", method + ", " + std::to_string(selected) + " of " + std::to_string(total) + " rows in " + std::to_string(probes) + " range(s)", selected, false, {} };
+                };
+            m_cursor_provider = [source, ranges](const detail::ExecutionContext&) {
+                return detail::makeCursor<T>([source, ranges, range = size_t{ 0 }, index = size_t{ 0 }]() mutable -> const T* {
+                    while (range < ranges->size()) {
+                        if (index < (*ranges)[range].first) index = (*ranges)[range].first;
+                        if (index < (*ranges)[range].second) return &(*source)[index++];
+                        ++range;
+                    }
+                    return nullptr;
+                    });
+                };
+            return;
+        }
+        m_source_provider = [source](const detail::ExecutionContext& ctx) {
+            detail::OperatorScope scope(ctx, "Source", source->size());
+            if (ctx.guard) { ctx.guard->scanRows(source->size()); } // before paying for the copy
+            if (ctx.consume_source && source.use_count() == 1) {
+                Buffer rows(std::make_move_iterator(source->begin()), std::make_move_iterator(source->end()), ctx.resource);
+                source->clear();
+                scope.finish(rows.size(), 0);
+                return rows;
+            }
+            Buffer rows(source->begin(), source->end(), ctx.resource);
+            scope.finish(rows.size(), rows.size() * sizeof(T));
+            return rows;
+            };
+        m_input_plan = [rows = source->size()]() { return PlanNode{ "Source", "std::vector", rows, false, {} }; };
+        // Weak, so that use_count() above still tells whether another query shares the rows.
+        m_cursor_provider = [weak_source = std::weak_ptr<std::vector<T>>(source)](const detail::ExecutionContext&) {
+            return detail::makeCursor<T>([source = weak_source.lock(), index = size_t{ 0 }]() mutable -> const T* {
+                return index < source->size() ? &(*source)[index++] : nullptr;
+                });
+            };
+    }
+    // Restricts the source to `ranges`, intersected with any earlier probe.
+    template<typename T>
+    void DmLinq<T>::narrowSource(const std::shared_ptr<std::vector<T>>& rows, detail::RowRanges ranges, const char* method) {
+        if (!m_source_rows || m_source_rows != rows.get()) {
+            throw std::runtime_error("whereIndexed()/whereBetween() require a query started with from() on the table that owns the index.");
+        }
+        std::string label = method;
+        if (m_source_ranges) {
+            ranges = detail::intersectRanges(*m_source_ranges, ranges);
+            label = "index probe";
+        }
+        bindSource(rows, std::make_shared<const detail::RowRanges>(std::move(ranges)), std::move(label));
+    }
+    template<typename T>
+    DmLinq<T>::DmLinq(std::shared_ptr<void> previous_stage, SourceProvider source_provider)
+        : m_previous_stage(previous_stage), m_source_provider(source_provider) {
+    }
+    template<typename T>
+    DmLinq<T>::DmLinq(CursorProvider cursor_provider, std::function<PlanNode()> input_plan)
+        : m_input_plan(std::move(input_plan)), m_cursor_provider(cursor_provider) {
+        m_source_provider = [cursor_provider](const detail::ExecutionContext& ctx) {
+            detail::OperatorScope scope(ctx, "Source", 0);
+            auto cursor = cursor_provider(ctx);
+            auto rows = detail::drainCursor(*cursor, ctx.resource, ctx.guard);
+            scope.finish(rows.size(), rows.size() * sizeof(T));
+            return rows;
+            };
+    }
+
+    // Downstream stages keep a shared copy of this stage; with an arena attached it lives there too.
+    template<typename T>
+    std::shared_ptr<DmLinq<T>> DmLinq<T>::snapshot() const {
+        if (m_resource) { return std::allocate_shared<DmLinq<T>>(std::pmr::polymorphic_allocator<DmLinq<T>>(m_resource), *this); }
+        return std::make_shared<DmLinq<T>>(*this);
+    }
+    template<typename T>
+    template <typename TResult, typename TProvider>
+    DmLinq<TResult> DmLinq<T>::chain(std::shared_ptr<void> self, TProvider provider, std::function<PlanNode()> input_plan) const {
+        DmLinq<TResult> next(self, provider);
+        next.m_resource = m_resource;
+        next.m_profile = m_profile;
+        next.m_limits = m_limits;
+        next.m_parallelism = m_parallelism;
+        next.m_input_plan = std::move(input_plan);
+        return next;
+    }
+    // A stage fed by a cursor; materializing it simply drains the cursor.
+    template<typename T>
+    template <typename TResult, typename TCursorProvider>
+    DmLinq<TResult> DmLinq<T>::chainStreaming(std::shared_ptr<void> self, TCursorProvider cursor_provider, std::function<PlanNode()> input_plan) const {
+        auto drain = [cursor_provider](const detail::ExecutionContext& ctx) {
+            auto cursor = cursor_provider(ctx);
+            return detail::drainCursor(*cursor, ctx.resource);
+            };
+        DmLinq<TResult> next = chain<TResult>(std::move(self), drain, std::move(input_plan));
+        next.m_cursor_provider = cursor_provider;
+        return next;
+    }
+
+    template <typename T>
+    DmLinq<T> from(const std::vector<T>& source) {
+        return DmLinq<T>(std::make_shared<std::vector<T>>(source));
+    }
+    template <typename T>
+    DmLinq<T> from(std::vector<T>&& source) {
+        return DmLinq<T>(std::make_shared<std::vector<T>>(std::move(source)));
+    }
+    template <typename T>
+    DmLinq<T> from(const IndexedVector<T>& table) {
+        return DmLinq<T>(table.m_rows);
+    }
+    // Generator sources are consumed as they are pulled: a second execution continues where the
+    // first one stopped.
+    template <typename TPull>
+    auto fromGenerator(TPull pull) -> DmLinq<typename std::invoke_result_t<TPull&>::value_type> {
+        using T = typename std::invoke_result_t<TPull&>::value_type;
+        auto state = std::make_shared<TPull>(std::move(pull));
+        auto cursor_provider = [state](const detail::ExecutionContext&) {
+            return detail::makeCursor<T>([state, current = std::optional<T>()]() mutable -> const T* {
+                current = (*state)();
+                return current ? &*current : nullptr;
+                });
+            };
+        return DmLinq<T>(cursor_provider, []() { return PlanNode{ "Source", "generator, single pass", std::nullopt, false, {} }; });
+    }
+    template <typename TFetch>
+    auto fromPages(TFetch fetch_page) -> DmLinq<typename std::invoke_result_t<TFetch&>::value_type> {
+        using TPage = std::invoke_result_t<TFetch&>;
+        using T = typename TPage::value_type;
+        auto state = std::make_shared<TFetch>(std::move(fetch_page));
+        auto cursor_provider = [state](const detail::ExecutionContext&) {
+            // The next page is fetched only when the current one is used up.
+            return detail::makeCursor<T>([state, page = TPage(), index = size_t{ 0 }, exhausted = false]() mutable -> const T* {
+                while (!exhausted && index == page.size()) {
+                    page = (*state)();
+                    index = 0;
+                    exhausted = page.empty();
+                }
+                return exhausted ? nullptr : &page[index++];
+                });
+            };
+        return DmLinq<T>(cursor_provider, []() { return PlanNode{ "Source", "paged generator, single pass", std::nullopt, false, {} }; });
+    }
+#ifdef DMLINQ_HAS_COROUTINES
+    template <typename T>
+    DmLinq<T> from(Generator<T> generator) {
+        return fromGenerator([generator = std::make_shared<Generator<T>>(std::move(generator))]() { return generator->next(); });
+    }
+#endif
+
+    // --- dmlinq_execution ---
+    // `guard` belongs to the caller and has to outlive everything the execution allocates.
+    template<typename T>
+    detail::ExecutionContext DmLinq<T>::topLevelContext(bool consume_source, detail::QueryGuard& guard) const {
+        detail::ExecutionContext ctx{ executionResource(), nullptr, consume_source };
+#ifdef DMLINQ_ENABLE_PROFILING
+        if (m_profile) {
+            m_profile->counter().reset(ctx.resource);
+            ctx = detail::ExecutionContext{ &m_profile->counter(), m_profile, consume_source };
+        }
+#endif
+        if (m_limits) {
+            guard.arm(*m_limits, ctx.resource);
+            ctx.guard = &guard;
+            if (guard.limitsBytes()) { ctx.resource = &guard; }
+        }
+        return ctx;
+    }
+    template<typename T>
+    typename DmLinq<T>::Buffer DmLinq<T>::execute(detail::QueryGuard& guard, bool consume_source) const {
+        return execute(topLevelContext(consume_source, guard));
+    }
+    // Feeds every result row to visit (which returns false to stop). Unsorted pullable queries are
+    // streamed straight from their input, so scalar aggregates never materialize the result set.
+    template<typename T>
+    template <typename TVisit>
+    void DmLinq<T>::forEachRow(TVisit visit) const {
+        detail::QueryGuard guard;
+        auto ctx = topLevelContext(false, guard);
+        if (m_cursor_provider && !m_sorter) {
+            detail::OperatorScope scope(ctx, "Scan", 0);
+            size_t rows = 0;
+            auto cursor = openCursor(ctx);
+            while (const T* row = cursor->next()) {
+                ++rows;
+                if (!visit(*row)) break;
+            }
+            scope.finish(rows, 0);
+            return;
+        }
+        auto rows = execute(ctx);
+        for (const auto& row : rows) {
+            if (!visit(row)) return;
+        }
+    }
+    template<typename T>
+    typename DmLinq<T>::Buffer DmLinq<T>::execute(const detail::ExecutionContext& ctx) const {
+        // An unsorted take() over a pullable input stops scanning once it has its rows.
+        if (m_cursor_provider && !m_sorter && m_take_count.has_value()) {
+            detail::OperatorScope scope(ctx, "Scan", 0);
+            Buffer results(ctx.resource);
+            results.reserve(*m_take_count);
+            auto cursor = openCursor(ctx);
+            while (const T* row = cursor->next()) { results.push_back(*row); }
+            scope.finish(results.size(), results.size() * sizeof(T));
+            return results;
+        }
+        // A budgeted sort over a pullable input cuts its runs while scanning, so the input is never
+        // held in memory as a whole.
+        if constexpr (detail::is_spillable_v<T>) {
+            if (m_sorter && m_memory_limit.has_value() && m_cursor_provider) {
+                auto input = openInput(ctx);
+                return externalSort([&input]() { return input->next(); }, ctx);
+            }
+        }
+        // Only the expiring query's own source may be moved out: upstream stages are shared snapshots
+        // that other queries can still run, even when their source reports a single owner.
+        detail::ExecutionContext source_ctx = ctx;
+        if (m_previous_stage) { source_ctx.consume_source = false; }
+        Buffer results = m_source_provider(source_ctx);
+        if constexpr (detail::is_spillable_v<T>) {
+            if (m_sorter && m_memory_limit.has_value()) {
+                return externalSort([&results, index = size_t{ 0 }]() mutable -> T* {
+                    return index < results.size() ? &results[index++] : nullptr;
+                    }, ctx);
+            }
+        }
+        if (!m_filters.empty()) {
+            detail::OperatorScope scope(ctx, "Filter", results.size());
+            size_t kept = 0;
+            size_t moved = 0;
+            for (size_t i = 0; i < results.size(); ++i) {
+                if (ctx.guard) { ctx.guard->tick(); }
+                bool keep = true;
+                for (const auto& filter : m_filters) {
+                    if (!filter(results[i])) { keep = false; break; }
+                }
+                if (!keep) continue;
+                if (kept != i) { results[kept] = std::move(results[i]); ++moved; }
+                ++kept;
+            }
+            results.erase(results.begin() + kept, results.end());
+            scope.finish(kept, moved * sizeof(T));
+        }
+        if (m_sorter) {
+            if (m_take_count.has_value() && detail::preferTopK(m_skip_count + *m_take_count, results.size())) {
+                detail::OperatorScope scope(ctx, "TopK", results.size());
+                if (ctx.guard) { detail::stableTopK(results, m_skip_count + *m_take_count, detail::guardedCompare(m_sorter, *ctx.guard)); }
+                else { detail::stableTopK(results, m_skip_count + *m_take_count, m_sorter); }
+                scope.finish(results.size(), results.size() * sizeof(T));
+            }
+            else {
+                detail::OperatorScope scope(ctx, "Sort", results.size());
+                if (ctx.guard) { detail::stableSort(results, detail::guardedCompare(m_sorter, *ctx.guard)); }
+                else { detail::stableSort(results, m_sorter); }
+                scope.finish(results.size(), results.size() * sizeof(T));
+            }
+        }
+        if (m_skip_count > 0) {
+            detail::OperatorScope scope(ctx, "Skip", results.size());
+            size_t shifted = 0;
+            if (m_skip_count >= results.size()) {
+                results.clear();
+            }
+            else {
+                results.erase(results.begin(), results.begin() + m_skip_count);
+                shifted = results.size();
+            }
+            scope.finish(results.size(), shifted * sizeof(T));
+        }
+        if (m_take_count.has_value()) {
+            detail::OperatorScope scope(ctx, "Take", results.size());
+            if (*m_take_count < results.size()) {
+                results.resize(*m_take_count);
+            }
+            scope.finish(results.size(), 0);
+        }
+        return results;
+    }
+
+    // Memory-budgeted sort: rows pulled from next_row (nullptr at the end) are filtered and cut
+    // into stably sorted runs of at most m_memory_limit bytes, each run is spilled to a temp file
+    // as soon as it fills, and the runs are k-way merged. Ties are resolved by run index, so the
+    // result stays stable. A next_row that hands out mutable rows has them moved into the runs.
+    template<typename T>
+    template <typename TPull>
+    typename DmLinq<T>::Buffer DmLinq<T>::externalSort(TPull next_row, const detail::ExecutionContext& ctx) const {
+        detail::OperatorScope scope(ctx, "ExternalSort", 0);
+        auto resource = ctx.resource;
+        std::vector<detail::SpillFile> runs;
+        Buffer run(resource);
+        size_t run_bytes = 0;
+        auto sort_run = [&]() {
+            if (ctx.guard) { detail::stableSort(run, detail::guardedCompare(m_sorter, *ctx.guard)); }
+            else { detail::stableSort(run, m_sorter); }
+        };
+        auto spill_run = [&]() {
+            sort_run();
+            detail::SpillFile file;
+            for (const auto& item : run) { file.write(item); }
+            file.rewind();
+            runs.push_back(std::move(file));
+            run.clear();
+            run_bytes = 0;
+        };
+        while (auto* item = next_row()) {
+            if (ctx.guard) { ctx.guard->tick(); }
+            bool keep = true;
+            for (const auto& filter : m_filters) {
+                if (!filter(*item)) { keep = false; break; }
+            }
+            if (!keep) continue;
+            size_t item_bytes = SpillCodec<T>::bytes(*item);
+            if (!run.empty() && run_bytes + item_bytes > *m_memory_limit) { spill_run(); }
+            run.push_back(std::move(*item)); // a copy when the input hands out const rows
+            run_bytes += item_bytes;
+        }
+
+        if (runs.empty()) {
+            // Everything fit in one run; no need to touch the disk.
+            sort_run();
+            size_t first = (std::min)(m_skip_count, run.size());
+            size_t last = m_take_count.has_value() ? (std::min)(run.size(), first + *m_take_count) : run.size();
+            Buffer results(std::make_move_iterator(run.begin() + first), std::make_move_iterator(run.begin() + last), resource);
+            scope.finish(results.size(), (run.size() + results.size()) * sizeof(T));
+            return results;
+        }
+        if (!run.empty()) { spill_run(); }
+        Buffer(resource).swap(run);
+
+        Buffer heads(runs.size(), resource);
+        auto later = [this, &heads](size_t a, size_t b) {
+            if (m_sorter(heads[b], heads[a])) return true;
+            if (m_sorter(heads[a], heads[b])) return false;
+            return b < a;
+        };
+        std::priority_queue<size_t, std::pmr::vector<size_t>, decltype(later)> merge_heap(later, std::pmr::vector<size_t>(resource));
+        for (size_t i = 0; i < runs.size(); ++i) {
+            if (runs[i].read(heads[i])) merge_heap.push(i);
+        }
+
+        Buffer results(resource);
+        size_t skipped = 0;
+        while (!merge_heap.empty()) {
+            if (m_take_count.has_value() && results.size() >= *m_take_count) break;
+            if (ctx.guard) { ctx.guard->tick(); }
+            size_t i = merge_heap.top();
+            merge_heap.pop();
+            if (skipped < m_skip_count) { ++skipped; }
+            else { results.push_back(std::move(heads[i])); }
+            if (runs[i].read(heads[i])) merge_heap.push(i);
+        }
+        scope.finish(results.size(), results.size() * sizeof(T));
+        return results;
+    }
+
+    // This stage's unfiltered input as a cursor; rows leaving a source count against the row limit.
+    template<typename T>
+    std::unique_ptr<detail::Cursor<T>> DmLinq<T>::openInput(const detail::ExecutionContext& ctx) const {
+        auto upstream = m_cursor_provider(ctx);
+        if (ctx.guard && !m_previous_stage) {
+            upstream = detail::makeCursor<T>([upstream = std::move(upstream), guard = ctx.guard]() -> const T* {
+                const T* row = upstream->next();
+                if (row) { guard->scanRow(); }
+                return row;
+                });
+        }
+        return upstream;
+    }
+    // Pulls this stage's output row by row. Unsorted stages with a pullable input apply their
+    // filters, skip and take lazily, so downstream streaming operators can stop the scan early;
+    // anything else is materialized first and then iterated.
+    template<typename T>
+    std::unique_ptr<detail::Cursor<T>> DmLinq<T>::openCursor(const detail::ExecutionContext& ctx) const {
+        if (!m_cursor_provider || m_sorter) {
+            auto rows = std::make_shared<Buffer>(execute(ctx));
+            return detail::makeCursor<T>([rows, index = size_t{ 0 }]() mutable -> const T* {
+                return index < rows->size() ? &(*rows)[index++] : nullptr;
+                });
+        }
+        auto upstream = openInput(ctx);
+        if (m_filters.empty() && m_skip_count == 0 && !m_take_count.has_value()) { return upstream; }
+        return detail::makeCursor<T>([this, upstream = std::move(upstream), skipped = size_t{ 0 }, taken = size_t{ 0 }]() mutable -> const T* {
+            if (m_take_count.has_value() && taken >= *m_take_count) return nullptr;
+            while (const T* row = upstream->next()) {
+                bool keep = true;
+                for (const auto& filter : m_filters) {
+                    if (!filter(*row)) { keep = false; break; }
+                }
+                if (!keep) continue;
+                if (skipped < m_skip_count) { ++skipped; continue; }
+                ++taken;
+                return row;
+            }
+            return nullptr;
+            });
+    }
+
+    // --- dmlinq_explain ---
+    // Names the in-memory sort detail::stableSort() will pick: std::stable_sort when buffers come from
+    // the default resource, its own merge sort when topLevelContext() routes them through an arena,
+    // a profile counter or a byte-limit guard (std::stable_sort would allocate from the global heap).
+    template<typename T>
+    std::string DmLinq<T>::sortAlgorithm() const {
+        bool wrapped = executionResource() != std::pmr::get_default_resource() || (m_limits && m_limits->max_bytes_allocated);
+#ifdef DMLINQ_ENABLE_PROFILING
+        wrapped = wrapped || m_profile;
+#endif
+        return wrapped ? "stable merge sort (query resource)" : "std::stable_sort";
+    }
+
+    // Describes the operators execute() will run, innermost input first in the tree. Stages pull rows
+    // from their input through cursors, so only pipeline breakers that must read their whole input
+    // before emitting a row (sorts, hash tables, reservoirs) are marked as materializing.
+    template<typename T>
+    PlanNode DmLinq<T>::explain() const {
+        PlanNode node = m_input_plan ? m_input_plan() : PlanNode{ "Source", "provider", std::nullopt, true, {} };
+        auto rows = node.estimated_rows;
+        if (!m_filters.empty()) {
+            if (rows) { rows = static_cast<size_t>(*rows * std::pow(detail::kFilterSelectivity, static_cast<double>(m_filters.size()))); }
+            node = detail::planOver("Filter", std::to_string(m_filters.size()) + " predicate(s)", std::move(node), rows, false);
+        }
+        if (m_sorter) {
+            // Mirrors the choice in execute(); without a row estimate top-k is decided on the actual input.
+            std::string algorithm = sortAlgorithm();
+            if (m_memory_limit.has_value() && detail::is_spillable_v<T>) {
+                algorithm = "external merge sort, budget " + std::to_string(*m_memory_limit) + " bytes";
+            }
+            else if (m_take_count.has_value()) {
+                size_t k = m_skip_count + *m_take_count;
+                if (!rows) { algorithm = "top-k partial sort, k=" + std::to_string(k) + " if input > " + std::to_string(4 * k) + " rows, else " + algorithm; }
+                else if (detail::preferTopK(k, *rows)) { algorithm = "top-k partial sort, k=" + std::to_string(k); }
+            }
+            node = detail::planOver("Sort", algorithm, std::move(node), rows, true);
+        }
+        if (m_skip_count > 0) {
+            if (rows) { rows = *rows > m_skip_count ? *rows - m_skip_count : 0; }
+            node = detail::planOver("Skip", std::to_string(m_skip_count), std::move(node), rows, false);
+        }
+        if (m_take_count.has_value()) {
+            if (rows) { rows = (std::min)(*rows, *m_take_count); }
+            else { rows = *m_take_count; }
+            node = detail::planOver("Take", std::to_string(*m_take_count), std::move(node), rows, false);
+        }
+        return node;
+    }
+
+    // --- dmlinq_filtering ---
+    // Every modifier comes in two forms. On an expiring query (a temporary in a call chain) the
+    // change is made in place and the query moved on; on any other query the change is made to
+    // a copy, so a base query shared between threads is never written to.
+    template <typename T>
+    template<typename TFunc>
+    DmLinq<T> DmLinq<T>::where(TFunc predicate) && {
+        m_filters.push_back(predicate);
+        return std::move(*this);
+    }
+    template <typename T>
+    template<typename TFunc>
+    DmLinq<T> DmLinq<T>::where(TFunc predicate) const& { return DmLinq<T>(*this).where(predicate); }
+
+    template <typename T>
+    template <typename TKey>
+    DmLinq<T> DmLinq<T>::whereIndexed(const HashIndex<T, TKey>& index, const detail::TypeIdentityT<TKey>& key) && {
+        narrowSource(index.rows(), index.probe(key), "index probe");
+        return std::move(*this);
+    }
+    template <typename T>
+    template <typename TKey>
+    DmLinq<T> DmLinq<T>::whereIndexed(const HashIndex<T, TKey>& index, const detail::TypeIdentityT<TKey>& key) const& { return DmLinq<T>(*this).whereIndexed(index, key); }
+    template <typename T>
+    template <typename TKey>
+    DmLinq<T> DmLinq<T>::whereIndexed(const OrderedIndex<T, TKey>& index, const detail::TypeIdentityT<TKey>& lo, const detail::TypeIdentityT<TKey>& hi) && {
+        narrowSource(index.rows(), index.probe(lo, hi), "index probe");
+        return std::move(*this);
+    }
+    template <typename T>
+    template <typename TKey>
+    DmLinq<T> DmLinq<T>::whereIndexed(const OrderedIndex<T, TKey>& index, const detail::TypeIdentityT<TKey>& lo, const detail::TypeIdentityT<TKey>& hi) const& {
+        return DmLinq<T>(*this).whereIndexed(index, lo, hi);
+    }
+    // Zone maps only prune blocks, so the exact range check still runs on the rows that are read.
+    template <typename T>
+    template <typename TKey>
+    DmLinq<T> DmLinq<T>::whereBetween(const ZoneMap<T, TKey>& zones, const detail::TypeIdentityT<TKey>& lo, const detail::TypeIdentityT<TKey>& hi) && {
+        narrowSource(zones.rows(), zones.probe(lo, hi), "zone map");
+        return std::move(*this).whereBetween(zones.keySelector(), lo, hi);
+    }
+    template <typename T>
+    template <typename TKey>
+    DmLinq<T> DmLinq<T>::whereBetween(const ZoneMap<T, TKey>& zones, const detail::TypeIdentityT<TKey>& lo, const detail::TypeIdentityT<TKey>& hi) const& {
+        return DmLinq<T>(*this).whereBetween(zones, lo, hi);
+    }
+    template <typename T>
+    template <typename TFunc, typename TKey, std::enable_if_t<std::is_invocable_v<TFunc, const T&>, int>>
+    DmLinq<T> DmLinq<T>::whereBetween(TFunc key_selector, const TKey& lo, const TKey& hi) && {
+        return std::move(*this).where([key_selector, lo, hi](const T& row) {
+            const auto& key = key_selector(row);
+            return !(key < lo) && !(hi < key);
+            });
+    }
+    template <typename T>
+    template <typename TFunc, typename TKey, std::enable_if_t<std::is_invocable_v<TFunc, const T&>, int>>
+    DmLinq<T> DmLinq<T>::whereBetween(TFunc key_selector, const TKey& lo, const TKey& hi) const& { return DmLinq<T>(*this).whereBetween(key_selector, lo, hi); }
+
+    // --- dmlinq_sorting ---
+    template <typename T>
+    template <typename TFunc>
+    DmLinq<T> DmLinq<T>::orderBy(TFunc key_selector, SortDirection direction) && {
+        m_sorter.clear();
+        m_sorter.add(key_selector, direction);
+        return std::move(*this);
+    }
+    template <typename T>
+    template <typename TFunc>
+    DmLinq<T> DmLinq<T>::orderBy(TFunc key_selector, SortDirection direction) const& { return DmLinq<T>(*this).orderBy(key_selector, direction); }
+    template <typename T>
+    template <typename TFunc>
+    DmLinq<T> DmLinq<T>::orderByDescending(TFunc key_selector) && { return std::move(*this).orderBy(key_selector, SortDirection::DESC); }
+    template <typename T>
+    template <typename TFunc>
+    DmLinq<T> DmLinq<T>::orderByDescending(TFunc key_selector) const& { return DmLinq<T>(*this).orderBy(key_selector, SortDirection::DESC); }
+    template <typename T>
+    template <typename TFunc>
+    DmLinq<T> DmLinq<T>::thenBy(TFunc key_selector, SortDirection direction) && {
+        if (!m_sorter) { return std::move(*this).orderBy(key_selector, direction); }
+        m_sorter.add(key_selector, direction);
+        return std::move(*this);
+    }
+    template <typename T>
+    template <typename TFunc>
+    DmLinq<T> DmLinq<T>::thenBy(TFunc key_selector, SortDirection direction) const& { return DmLinq<T>(*this).thenBy(key_selector, direction); }
+    template <typename T>
+    template <typename TFunc>
+    DmLinq<T> DmLinq<T>::thenByDescending(TFunc key_selector) && { return std::move(*this).thenBy(key_selector, SortDirection::DESC); }
+    template <typename T>
+    template <typename TFunc>
+    DmLinq<T> DmLinq<T>::thenByDescending(TFunc key_selector) const& { return DmLinq<T>(*this).thenBy(key_selector, SortDirection::DESC); }
+
+    // --- dmlinq_projection ---
+    template <typename T>
+    template <typename TFunc>
+    auto DmLinq<T>::select(TFunc selector) const -> DmLinq<std::invoke_result_t<TFunc, const T&>> {
+        using TResult = std::invoke_result_t<TFunc, const T&>;
+        auto self = snapshot();
+        auto new_source_provider = [self, selector](const detail::ExecutionContext& ctx) {
+            auto source = self->execute(ctx);
+            detail::OperatorScope scope(ctx, "Select", source.size());
+            std::pmr::vector<TResult> result(ctx.resource);
+            result.reserve(source.size());
+            for (const auto& item : source) { result.push_back(selector(item)); }
+            scope.finish(result.size(), result.size() * sizeof(TResult));
+            return result;
+            };
+        auto next = chain<TResult>(self, new_source_provider, [self]() {
+            auto input = self->explain();
+            auto rows = input.estimated_rows;
+            return detail::planOver("Select", "", std::move(input), rows, false);
+            });
+        next.m_cursor_provider = [self, selector](const detail::ExecutionContext& ctx) {
+            return detail::makeCursor<TResult>([upstream = self->openCursor(ctx), selector, current = std::optional<TResult>()]() mutable -> const TResult* {
+                const T* row = upstream->next();
+                if (!row) return nullptr;
+                current.emplace(selector(*row));
+                return &*current;
+                });
+            };
+        return next;
+    }
+    template <typename T>
+    template <typename TFunc>
+    auto DmLinq<T>::selectMany(TFunc selector) const -> DmLinq<typename std::invoke_result_t<TFunc, const T&>::value_type> {
+        using TResultVector = std::invoke_result_t<TFunc, const T&>;
+        using TResult = typename TResultVector::value_type;
+        auto self = snapshot();
+        auto new_source_provider = [self, selector](const detail::ExecutionContext& ctx) {
+            auto source = self->execute(ctx);
+            detail::OperatorScope scope(ctx, "SelectMany", source.size());
+            std::pmr::vector<TResult> result(ctx.resource);
+            for (const auto& item : source) {
+                auto sub_sequence = selector(item);
+                result.insert(result.end(), sub_sequence.begin(), sub_sequence.end());
+            }
+            scope.finish(result.size(), result.size() * sizeof(TResult));
+            return result;
+            };
+        return chain<TResult>(self, new_source_provider, [self]() { return detail::planOver("SelectMany", "", self->explain(), std::nullopt, true); });
+    }
+
+    // --- dmlinq_grouping ---
+    // Groups are emitted in order of first appearance. The input is pulled through a cursor, and
+    // under withMemoryLimit() the hash table is bounded: once it would exceed the budget the rest of
+    // the input is grace-hash partitioned to temp files as it streams in, and groups are emitted
+    // partition by partition instead.
+    template <typename T>
+    template <typename TFunc>
+    auto DmLinq<T>::groupBy(TFunc key_selector) const -> DmLinq<std::pair<std::decay_t<std::invoke_result_t<TFunc, const T&>>, std::vector<T>>> {
+        using TKey = std::decay_t<std::invoke_result_t<TFunc, const T&>>;
+        using TGroup = std::pair<TKey, std::vector<T>>;
+        auto self = snapshot();
+        auto budget = m_memory_limit;
+        auto new_source_provider = [self, key_selector, budget](const detail::ExecutionContext& ctx) {
+            auto upstream = self->openCursor(ctx);
+            detail::OperatorScope scope(ctx, "GroupBy", 0);
+            size_t rows_in = 0;
+            auto resource = ctx.resource;
+            std::pmr::vector<TGroup> result(resource);
+            // The table is the groups from first_group on. Once it overflows, the rows it holds and
+            // all later rows of this level are spilled, so no group is split between memory and disk.
+            std::pmr::unordered_map<TKey, size_t> index(resource);
+            size_t first_group = 0;
+            size_t table_bytes = 0;
+            bool spilling = false;
+            auto add = [&](const T& row, size_t limit) {
+                if (spilling) return false;
+                TKey key = key_selector(row);
+                auto it = index.find(key);
+                size_t row_bytes = detail::approxBytes(row) + (it == index.end() ? detail::approxBytes(key) + detail::kHashEntryOverhead : 0);
+                if (table_bytes + row_bytes > limit) return false;
+                table_bytes += row_bytes;
+                if (it == index.end()) {
+                    it = index.emplace(key, result.size()).first;
+                    result.emplace_back(std::move(key), std::vector<T>{});
+                }
+                result[it->second].second.push_back(row);
+                return true;
+            };
+            auto flush = [&]() {
+                index.clear();
+                first_group = result.size();
+                table_bytes = 0;
+                spilling = false;
+            };
+            auto next_row = [&upstream, &rows_in]() {
+                const T* row = upstream->next();
+                if (row) { ++rows_in; }
+                return row;
+            };
+            // withMemoryLimit() only compiles for a spillable T, so other queries never carry a budget.
+            bool partitioned = false;
+            if constexpr (detail::is_spillable_v<T>) {
+                if (budget.has_value()) {
+                    auto overflow = [&](const auto& spill) {
+                        for (size_t g = first_group; g < result.size(); ++g) {
+                            for (const auto& row : result[g].second) { spill(row); }
+                        }
+                        result.erase(result.begin() + first_group, result.end());
+                        index.clear();
+                        table_bytes = 0;
+                        spilling = true;
+                    };
+                    detail::graceHashStream<T>(next_row, key_selector, *budget, 0, add, overflow, flush);
+                    partitioned = true;
+                }
+            }
+            if (!partitioned) {
+                while (const T* row = next_row()) { add(*row, (std::numeric_limits<size_t>::max)()); }
+            }
+            scope.finish(result.size(), rows_in * sizeof(T));
+            return result;
+            };
+        return chain<TGroup>(self, new_source_provider, [self, budget]() {
+            auto input = self->explain();
+            auto rows = input.estimated_rows;
+            return detail::planOver("GroupBy", budget ? "grace hash, budget " + std::to_string(*budget) + " bytes" : "hash", std::move(input), rows, true);
+            });
+    }
+    template <typename T>
+    template <typename TKeyFunc, typename TAcc, typename TFoldFunc>
+    auto DmLinq<T>::aggregateBy(TKeyFunc key_selector, TAcc seed, TFoldFunc fold) const -> DmLinq<std::pair<std::decay_t<std::invoke_result_t<TKeyFunc, const T&>>, TAcc>> {
+        using TKey = std::decay_t<std::invoke_result_t<TKeyFunc, const T&>>;
+        using TEntry = std::pair<TKey, TAcc>;
+        auto self = snapshot();
+        auto budget = m_memory_limit;
+        auto new_source_provider = [self, key_selector, seed, fold, budget](const detail::ExecutionContext& ctx) {
+            auto upstream = self->openCursor(ctx);
+            detail::OperatorScope scope(ctx, "AggregateBy", 0);
+            auto resource = ctx.resource;
+            std::pmr::vector<TEntry> result(resource);
+            // Hybrid hash aggregation: once the table is full it admits no new keys, but keys already
+            // in it keep folding in memory, so only rows of the other keys are spilled.
+            std::pmr::unordered_map<TKey, size_t> index(resource);
+            std::pmr::vector<TEntry> entries(resource);
+            size_t table_bytes = 0;
+            bool full = false;
+            auto add = [&](const T& row, size_t limit) {
+                TKey key = key_selector(row);
+                auto it = index.find(key);
+                if (it == index.end()) {
+                    size_t entry_bytes = detail::approxBytes(key) + detail::approxBytes(seed) + detail::kHashEntryOverhead;
+                    if (full || table_bytes + entry_bytes > limit) return false;
+                    table_bytes += entry_bytes;
+                    it = index.emplace(key, entries.size()).first;
+                    entries.emplace_back(std::move(key), seed);
+                }
+                auto& acc = entries[it->second].second;
+                acc = fold(acc, row);
+                return true;
+            };
+            auto flush = [&]() {
+                result.insert(result.end(), std::make_move_iterator(entries.begin()), std::make_move_iterator(entries.end()));
+                entries.clear();
+                index.clear();
+                table_bytes = 0;
+                full = false;
+            };
+            auto next_row = [&upstream]() { return upstream->next(); };
+            // withMemoryLimit() only compiles for a spillable T, so other queries never carry a budget.
+            bool partitioned = false;
+            if constexpr (detail::is_spillable_v<T>) {
+                if (budget.has_value()) {
+                    auto overflow = [&full](const auto&) { full = true; };
+                    detail::graceHashStream<T>(next_row, key_selector, *budget, 0, add, overflow, flush);
+                    partitioned = true;
+                }
+            }
+            if (!partitioned) {
+                while (const T* row = next_row()) { add(*row, (std::numeric_limits<size_t>::max)()); }
+                flush();
+            }
+            scope.finish(result.size(), result.size() * sizeof(TEntry));
+            return result;
+            };
+        return chain<TEntry>(self, new_source_provider, [self, budget]() {
+            auto input = self->explain();
+            auto rows = input.estimated_rows;
+            return detail::planOver("AggregateBy", budget ? "grace hash, budget " + std::to_string(*budget) + " bytes" : "hash", std::move(input), rows, true);
+            });
+    }
+
+    // Counting with a flat key index instead of groupBy(): per distinct key only the key and one
+    // counter are stored, never the rows.
+    template <typename T>
+    template <typename TFunc>
+    auto DmLinq<T>::countBy(TFunc key_selector) const -> DmLinq<std::pair<std::decay_t<std::invoke_result_t<TFunc, const T&>>, size_t>> {
+        using TKey = std::decay_t<std::invoke_result_t<TFunc, const T&>>;
+        using TEntry = std::pair<TKey, size_t>;
+        auto self = snapshot();
+        auto new_source_provider = [self, key_selector](const detail::ExecutionContext& ctx) {
+            auto upstream = self->openCursor(ctx);
+            detail::OperatorScope scope(ctx, "CountBy", 0);
+            detail::FlatKeyIndex<TKey> index(ctx.resource);
+            std::pmr::vector<size_t> counts(ctx.resource);
+            while (const T* row = upstream->next()) {
+                auto slot = index.insert(key_selector(*row));
+                if (slot.second) { counts.push_back(0); }
+                ++counts[slot.first];
+            }
+            std::pmr::vector<TEntry> result(ctx.resource);
+            result.reserve(index.size());
+            for (size_t i = 0; i < index.size(); ++i) { result.emplace_back(std::move(index.keys()[i]), counts[i]); }
+            scope.finish(result.size(), result.size() * sizeof(TEntry));
+            return result;
+            };
+        return chain<TEntry>(self, new_source_provider, [self]() {
+            return detail::planOver("CountBy", "flat hash", self->explain(), std::nullopt, true);
+            });
+    }
+
+    // --- dmlinq_join ---
+    // Inner equi-join; the inner sequence is the hash table build side. In memory the output
+    // follows outer order and the outer side is streamed past the table. Under withMemoryLimit() on
+    // the outer query both sides are grace-hash partitioned while they stream in once the build side
+    // exceeds the budget, and output follows partition order.
+    template <typename T>
+    template <typename TInner, typename TOuterKeyFunc, typename TInnerKeyFunc, typename TResultFunc>
+    auto DmLinq<T>::join(const DmLinq<TInner>& inner, TOuterKeyFunc outer_key_selector, TInnerKeyFunc inner_key_selector, TResultFunc result_selector) const
+        -> DmLinq<std::invoke_result_t<TResultFunc, const T&, const TInner&>> {
+        using TKey = std::decay_t<std::invoke_result_t<TOuterKeyFunc, const T&>>;
+        using TResult = std::invoke_result_t<TResultFunc, const T&, const TInner&>;
+        // Any query of a spillable T may carry withMemoryLimit(), and grace hash then spills both sides.
+        static_assert(!detail::is_spillable_v<T> || detail::is_spillable_v<TInner>,
+            "join() on a spillable outer query requires a spillable inner element type as well; specialize dmlinq::SpillCodec<TInner>.");
+        auto self = snapshot();
+        auto inner_self = inner.snapshot();
+        auto budget = m_memory_limit;
+        auto new_source_provider = [self, inner_self, outer_key_selector, inner_key_selector, result_selector, budget](const detail::ExecutionContext& ctx) {
+            detail::OperatorScope scope(ctx, "Join", 0);
+            auto resource = ctx.resource;
+            std::pmr::vector<TResult> result(resource);
+            using Table = std::pmr::unordered_map<TKey, std::pmr::vector<size_t>>;
+            // Indexes inner row i; false, leaving the table unchanged, once it would exceed limit bytes.
+            auto index_inner = [&](Table& table, const std::pmr::vector<TInner>& inner_part, size_t i, size_t& table_bytes, size_t limit) {
+                TKey key = inner_key_selector(inner_part[i]);
+                table_bytes += detail::approxBytes(inner_part[i]) + detail::approxBytes(key) + detail::kHashEntryOverhead;
+                if (table_bytes > limit) return false;
+                table[std::move(key)].push_back(i);
+                return true;
+            };
+            auto probe = [&](const Table& table, const std::pmr::vector<TInner>& inner_part, const T& outer_row) {
+                auto it = table.find(outer_key_selector(outer_row));
+                if (it == table.end()) return;
+                for (size_t i : it->second) { result.push_back(result_selector(outer_row, inner_part[i])); }
+            };
+            auto build = [&](Buffer& outer_part, std::pmr::vector<TInner>& inner_part, size_t limit) {
+                Table table(resource);
+                size_t table_bytes = 0;
+                for (size_t i = 0; i < inner_part.size(); ++i) {
+                    if (!index_inner(table, inner_part, i, table_bytes, limit)) return false;
+                }
+                for (const auto& outer_row : outer_part) { probe(table, inner_part, outer_row); }
+                return true;
+            };
+
+            // The build side is streamed into the table; if it fits, the outer side is streamed past it.
+            size_t limit = (std::numeric_limits<size_t>::max)();
+            if constexpr (detail::is_spillable_v<T>) {
+                if (budget.has_value()) { limit = *budget; }
+            }
+            auto inner_cursor = inner_self->openCursor(ctx);
+            std::pmr::vector<TInner> inner_rows(resource);
+            Table table(resource);
+            size_t table_bytes = 0;
+            bool fits = true;
+            while (const TInner* row = inner_cursor->next()) {
+                inner_rows.push_back(*row);
+                if (!index_inner(table, inner_rows, inner_rows.size() - 1, table_bytes, limit)) { fits = false; break; }
+            }
+            if (fits) {
+                auto outer_cursor = self->openCursor(ctx);
+                while (const T* row = outer_cursor->next()) { probe(table, inner_rows, *row); }
+            }
+            if constexpr (detail::is_spillable_v<T>) {
+                if (!fits) {
+                    // The build side outgrew the budget: the rest of both inputs is partitioned to spill
+                    // files while it streams in, then partition pairs are joined one level deeper. Both
+                    // sides are partitioned on the outer key type, so equal keys land in the same
+                    // partition even when the inner selector returns a different (convertible) type.
+                    auto inner_key = [&inner_key_selector](const TInner& row) { return TKey(inner_key_selector(row)); };
+                    Table(resource).swap(table);
+                    std::vector<detail::SpillFile> inner_partitions(detail::kSpillFanout);
+                    std::vector<detail::SpillFile> outer_partitions(detail::kSpillFanout);
+                    for (const auto& row : inner_rows) { detail::spillRow(inner_partitions, inner_key, 0, row); }
+                    std::pmr::vector<TInner>(resource).swap(inner_rows);
+                    while (const TInner* row = inner_cursor->next()) { detail::spillRow(inner_partitions, inner_key, 0, *row); }
+                    auto outer_cursor = self->openCursor(ctx);
+                    while (const T* row = outer_cursor->next()) { detail::spillRow(outer_partitions, outer_key_selector, 0, *row); }
+                    for (size_t i = 0; i < detail::kSpillFanout; ++i) {
+                        inner_partitions[i].rewind();
+                        outer_partitions[i].rewind();
+                        auto outer_part = detail::loadPartition<T>(outer_partitions[i], resource);
+                        if (outer_part.empty()) continue;
+                        auto inner_part = detail::loadPartition<TInner>(inner_partitions[i], resource);
+                        if (inner_part.empty()) continue;
+                        detail::graceHashJoin(outer_part, inner_part, outer_key_selector, inner_key, *budget, 1, build);
+                    }
+                }
+            }
+            scope.finish(result.size(), result.size() * sizeof(TResult));
+            return result;
+            };
+        return chain<TResult>(self, new_source_provider, [self, inner_self, budget]() {
+            auto outer_plan = self->explain();
+            auto rows = outer_plan.estimated_rows;
+            auto node = detail::planOver("Join", budget ? "grace hash join, budget " + std::to_string(*budget) + " bytes" : "hash join (build inner)", std::move(outer_plan), rows, true);
+            node.children.push_back(inner_self->explain());
+            return node;
+            });
+    }
+
+    // The hash set is built from the smaller input. With the inner side as build side, outer rows
+    // check the bloom filter first and only reach the hash set when it reports a possible match.
+    // With the outer side as build side, inner rows mark the outer keys they hit and the outer rows
+    // are emitted afterwards in their original order.
+    template <typename T>
+    template <typename TInner, typename TOuterKeyFunc, typename TInnerKeyFunc>
+    DmLinq<T> DmLinq<T>::membershipJoin(const DmLinq<TInner>& inner, TOuterKeyFunc outer_key_selector, TInnerKeyFunc inner_key_selector, bool keep_matches) const {
+        using TKey = std::decay_t<std::invoke_result_t<TOuterKeyFunc, const T&>>;
+        const char* op = keep_matches ? "SemiJoin" : "AntiJoin";
+        auto self = snapshot();
+        auto inner_self = inner.snapshot();
+        auto new_source_provider = [self, inner_self, outer_key_selector, inner_key_selector, keep_matches, op](const detail::ExecutionContext& ctx) {
+            auto outer_rows = self->execute(ctx);
+            auto inner_rows = inner_self->execute(ctx);
+            detail::OperatorScope scope(ctx, op, outer_rows.size() + inner_rows.size());
+            auto resource = ctx.resource;
+            Buffer result(resource);
+            if (inner_rows.size() <= outer_rows.size()) {
+                detail::BlockedBloomFilter bloom(inner_rows.size(), resource);
+                std::pmr::unordered_set<TKey> keys(resource);
+                keys.reserve(inner_rows.size());
+                for (const auto& row : inner_rows) {
+                    TKey key = inner_key_selector(row);
+                    bloom.insert(detail::mixedHash(key));
+                    keys.insert(std::move(key));
+                }
+                for (auto& row : outer_rows) {
+                    TKey key = outer_key_selector(row);
+                    bool found = bloom.mayContain(detail::mixedHash(key)) && keys.count(key) != 0;
+                    if (found == keep_matches) { result.push_back(std::move(row)); }
+                }
+            }
+            else {
+                detail::BlockedBloomFilter bloom(outer_rows.size(), resource);
+                std::pmr::unordered_map<TKey, bool> matched(resource);
+                matched.reserve(outer_rows.size());
+                for (const auto& row : outer_rows) {
+                    TKey key = outer_key_selector(row);
+                    bloom.insert(detail::mixedHash(key));
+                    matched.emplace(std::move(key), false);
+                }
+                for (const auto& row : inner_rows) {
+                    TKey key = inner_key_selector(row);
+                    if (!bloom.mayContain(detail::mixedHash(key))) continue;
+                    auto it = matched.find(key);
+                    if (it != matched.end()) { it->second = true; }
+                }
+                for (auto& row : outer_rows) {
+                    if (matched.find(outer_key_selector(row))->second == keep_matches) { result.push_back(std::move(row)); }
+                }
+            }
+            scope.finish(result.size(), result.size() * sizeof(T));
+            return result;
+            };
+        return chain<T>(self, new_source_provider, [self, inner_self, op]() {
+            auto outer_plan = self->explain();
+            auto rows = outer_plan.estimated_rows;
+            auto node = detail::planOver(op, "bloom filter + hash set (build smaller side)", std::move(outer_plan), rows, true);
+            node.children.push_back(inner_self->explain());
+            return node;
+            });
+    }
+
+    template <typename T>
+    template <typename TInner, typename TOuterKeyFunc, typename TInnerKeyFunc>
+    DmLinq<T> DmLinq<T>::semiJoin(const DmLinq<TInner>& inner, TOuterKeyFunc outer_key_selector, TInnerKeyFunc inner_key_selector) const {
+        return membershipJoin(inner, outer_key_selector, inner_key_selector, true);
+    }
+
+    template <typename T>
+    template <typename TInner, typename TOuterKeyFunc, typename TInnerKeyFunc>
+    DmLinq<T> DmLinq<T>::antiJoin(const DmLinq<TInner>& inner, TOuterKeyFunc outer_key_selector, TInnerKeyFunc inner_key_selector) const {
+        return membershipJoin(inner, outer_key_selector, inner_key_selector, false);
+    }
+
+    template <typename T>
+    template <typename TKey, typename TFunc>
+    DmLinq<T> DmLinq<T>::whereIn(const DmLinq<TKey>& keys, TFunc key_selector) const {
+        return membershipJoin(keys, key_selector, detail::Identity{}, true);
+    }
+
+    // --- dmlinq_partitioning ---
+    template <typename T>
+    DmLinq<T> DmLinq<T>::take(size_t count) && { m_take_count = count; return std::move(*this); }
+    template <typename T>
+    DmLinq<T> DmLinq<T>::take(size_t count) const& { return DmLinq<T>(*this).take(count); }
+    template <typename T>
+    DmLinq<T> DmLinq<T>::skip(size_t count) && { m_skip_count = count; return std::move(*this); }
+    template <typename T>
+    DmLinq<T> DmLinq<T>::skip(size_t count) const& { return DmLinq<T>(*this).skip(count); }
+    template <typename T>
+    template <typename TFunc>
+    DmLinq<T> DmLinq<T>::takeWhile(TFunc predicate) const {
+        auto self = snapshot();
+        auto cursor_provider = [self, predicate](const detail::ExecutionContext& ctx) {
+            return detail::makeCursor<T>([upstream = self->openCursor(ctx), predicate, done = false]() mutable -> const T* {
+                if (done) return nullptr;
+                const T* row = upstream->next();
+                if (row && predicate(*row)) return row;
+                done = true; // the rest of the input is never pulled
+                return nullptr;
+                });
+            };
+        return chainStreaming<T>(self, cursor_provider, [self]() {
+            return detail::planOver("TakeWhile", "streaming, stops at first mismatch", self->explain(), std::nullopt, false);
+            });
+    }
+    template <typename T>
+    template <typename TFunc>
+    DmLinq<T> DmLinq<T>::skipWhile(TFunc predicate) const {
+        auto self = snapshot();
+        auto cursor_provider = [self, predicate](const detail::ExecutionContext& ctx) {
+            return detail::makeCursor<T>([upstream = self->openCursor(ctx), predicate, skipping = true]() mutable -> const T* {
+                const T* row = upstream->next();
+                while (skipping && row && predicate(*row)) { row = upstream->next(); }
+                skipping = false;
+                return row;
+                });
+            };
+        return chainStreaming<T>(self, cursor_provider, [self]() {
+            return detail::planOver("SkipWhile", "streaming", self->explain(), std::nullopt, false);
+            });
+    }
+    template <typename T>
+    DmLinq<std::vector<T>> DmLinq<T>::chunk(size_t size) const {
+        if (size == 0) { throw std::runtime_error("chunk() size must be greater than zero."); }
+        auto self = snapshot();
+        auto cursor_provider = [self, size](const detail::ExecutionContext& ctx) {
+            // done remembers the end of the input: a partial last chunk has already seen it, and the
+            // upstream must not be pulled again on the next call.
+            return detail::makeCursor<std::vector<T>>([upstream = self->openCursor(ctx), size, current = std::vector<T>(), done = false]() mutable -> const std::vector<T>* {
+                current.clear();
+                if (done) return nullptr;
+                while (current.size() < size) {
+                    const T* row = upstream->next();
+                    if (!row) { done = true; break; }
+                    current.push_back(*row);
+                }
+                return current.empty() ? nullptr : &current;
+                });
+            };
+        return chainStreaming<std::vector<T>>(self, cursor_provider, [self, size]() {
+            auto input = self->explain();
+            std::optional<size_t> rows;
+            if (input.estimated_rows) { rows = (*input.estimated_rows + size - 1) / size; }
+            return detail::planOver("Chunk", "streaming, size " + std::to_string(size), std::move(input), rows, false);
+            });
+    }
+    // Full windows only: a trailing run shorter than size is dropped. With step > size the rows
+    // between windows are skipped.
+    template <typename T>
+    DmLinq<std::vector<T>> DmLinq<T>::window(size_t size, size_t step) const {
+        if (size == 0 || step == 0) { throw std::runtime_error("window() size and step must be greater than zero."); }
+        auto self = snapshot();
+        auto cursor_provider = [self, size, step](const detail::ExecutionContext& ctx) {
+            return detail::makeCursor<std::vector<T>>([upstream = self->openCursor(ctx), size, step, started = false,
+                rows = std::deque<T>(), current = std::vector<T>()]() mutable -> const std::vector<T>* {
+                if (started) {
+                    size_t dropped = (std::min)(step, rows.size());
+                    rows.erase(rows.begin(), rows.begin() + dropped);
+                    for (size_t gap = dropped; gap < step; ++gap) {
+                        if (!upstream->next()) return nullptr;
+                    }
+                }
+                while (rows.size() < size) {
+                    const T* row = upstream->next();
+                    if (!row) return nullptr;
+                    rows.push_back(*row);
+                }
+                started = true;
+                current.assign(rows.begin(), rows.end());
+                return &current;
+                });
+            };
+        return chainStreaming<std::vector<T>>(self, cursor_provider, [self, size, step]() {
+            auto input = self->explain();
+            std::optional<size_t> rows;
+            if (input.estimated_rows) { rows = *input.estimated_rows >= size ? (*input.estimated_rows - size) / step + 1 : 0; }
+            return detail::planOver("Window", "streaming, size " + std::to_string(size) + ", step " + std::to_string(step), std::move(input), rows, false);
+            });
+    }
+
+    template <typename T>
+    DmLinq<T> DmLinq<T>::withMemoryLimit(size_t bytes) && {
+        static_assert(detail::is_spillable_v<T>, "withMemoryLimit() requires a spillable element type; specialize dmlinq::SpillCodec<T>.");
+        m_memory_limit = bytes;
+        return std::move(*this);
+    }
+    template <typename T>
+    DmLinq<T> DmLinq<T>::withMemoryLimit(size_t bytes) const& { return DmLinq<T>(*this).withMemoryLimit(bytes); }
+    template <typename T>
+    DmLinq<T> DmLinq<T>::withArena(QueryArena& arena) && { return std::move(*this).withArena(arena.resource()); }
+    template <typename T>
+    DmLinq<T> DmLinq<T>::withArena(QueryArena& arena) const& { return DmLinq<T>(*this).withArena(arena.resource()); }
+    template <typename T>
+    DmLinq<T> DmLinq<T>::withArena(std::pmr::memory_resource* resource) && { m_resource = resource; return std::move(*this); }
+    template <typename T>
+    DmLinq<T> DmLinq<T>::withArena(std::pmr::memory_resource* resource) const& { return DmLinq<T>(*this).withArena(resource); }
+    template <typename T>
+    DmLinq<T> DmLinq<T>::withProfiling(QueryProfile& profile) && { m_profile = &profile; return std::move(*this); }
+    template <typename T>
+    DmLinq<T> DmLinq<T>::withProfiling(QueryProfile& profile) const& { return DmLinq<T>(*this).withProfiling(profile); }
+    template <typename T>
+    DmLinq<T> DmLinq<T>::withLimits(QueryLimits limits) && { m_limits = std::make_shared<const QueryLimits>(std::move(limits)); return std::move(*this); }
+    template <typename T>
+    DmLinq<T> DmLinq<T>::withLimits(QueryLimits limits) const& { return DmLinq<T>(*this).withLimits(std::move(limits)); }
+    template <typename T>
+    DmLinq<T> DmLinq<T>::withParallelism(size_t workers) && {
+        m_parallelism = workers != 0 ? workers : (std::max)(1u, std::thread::hardware_concurrency());
+        return std::move(*this);
+    }
+    template <typename T>
+    DmLinq<T> DmLinq<T>::withParallelism(size_t workers) const& { return DmLinq<T>(*this).withParallelism(workers); }
 
-    // Entry point for starting a LINQ query
+    // --- dmlinq_combining ---
+    // Multi-source operators pull from both inputs in lockstep; neither side is copied into a
+    // combined buffer unless the result itself is materialized.
     template <typename T>
-    [[nodiscard]] DmLinq<T> from(const std::vector<T>& source);
+    template <typename TOther, typename TFunc>
+    auto DmLinq<T>::zip(const DmLinq<TOther>& other, TFunc result_selector) const -> DmLinq<std::invoke_result_t<TFunc, const T&, const TOther&>> {
+        using TResult = std::invoke_result_t<TFunc, const T&, const TOther&>;
+        auto self = snapshot();
+        auto other_self = other.snapshot();
+        auto cursor_provider = [self, other_self, result_selector](const detail::ExecutionContext& ctx) {
+            return detail::makeCursor<TResult>([left = self->openCursor(ctx), right = other_self->openCursor(ctx), result_selector,
+                current = std::optional<TResult>()]() mutable -> const TResult* {
+                const T* a = left->next();
+                if (!a) return nullptr;
+                const TOther* b = right->next();
+                if (!b) return nullptr;
+                current.emplace(result_selector(*a, *b));
+                return &*current;
+                });
+            };
+        return chainStreaming<TResult>(self, cursor_provider, [self, other_self]() {
+            PlanNode node{ "Zip", "streaming, stops at shorter input", std::nullopt, false, {} };
+            node.children.push_back(self->explain());
+            node.children.push_back(other_self->explain());
+            if (node.children[0].estimated_rows && node.children[1].estimated_rows) {
+                node.estimated_rows = (std::min)(*node.children[0].estimated_rows, *node.children[1].estimated_rows);
+            }
+            return node;
+            });
+    }
     template <typename T>
-    [[nodiscard]] DmLinq<T> from(std::vector<T>&& source);
-
-
-    // Enum for sorting direction
-    enum class SortDirection {
-        ASC,
-        DESC
-    };
-
+    DmLinq<T> DmLinq<T>::concat(const DmLinq<T>& other) const {
+        auto self = snapshot();
+        auto other_self = other.snapshot();
+        auto cursor_provider = [self, other_self](const detail::ExecutionContext& ctx) {
+            // The second input is opened only once the first is exhausted.
+            return detail::makeCursor<T>([ctx, first = self->openCursor(ctx), other_self,
+                second = std::unique_ptr<detail::Cursor<T>>()]() mutable -> const T* {
+                if (first) {
+                    if (const T* row = first->next()) return row;
+                    first.reset();
+                    second = other_self->openCursor(ctx);
+                }
+                return second->next();
+                });
+            };
+        return chainStreaming<T>(self, cursor_provider, [self, other_self]() {
+            PlanNode node{ "Concat", "streaming", std::nullopt, false, {} };
+            node.children.push_back(self->explain());
+            node.children.push_back(other_self->explain());
+            if (node.children[0].estimated_rows && node.children[1].estimated_rows) {
+                node.estimated_rows = *node.children[0].estimated_rows + *node.children[1].estimated_rows;
+            }
+            return node;
+            });
+    }
+    // Both inputs must already be ascending by key; ties take the row from this side first.
     template <typename T>
-    class DmLinq {
-    public:
-        // Internal use for chaining
-        DmLinq(std::shared_ptr<void> previous_stage, std::function<std::vector<T>()> source_provider);
-
-    private:
-        friend DmLinq<T> from<T>(const std::vector<T>& source);
-        friend DmLinq<T> from<T>(std::vector<T>&& source);
-        DmLinq(const std::vector<T>& source);
-
-        // Pipeline components
-        std::shared_ptr<void> m_previous_stage;
-        std::function<std::vector<T>()> m_source_provider;
-        std::vector<std::function<bool(const T&)>> m_filters;
-        std::function<bool(const T&, const T&)> m_sorter;
-        size_t m_skip_count = 0;
-        std::optional<size_t> m_take_count;
+    template <typename TFunc>
+    DmLinq<T> DmLinq<T>::mergeSorted(const DmLinq<T>& other, TFunc key_selector) const {
+        auto self = snapshot();
+        auto other_self = other.snapshot();
+        auto cursor_provider = [self, other_self, key_selector](const detail::ExecutionContext& ctx) {
+            // A side is advanced only on the call after its row was returned, since a cursor's row
+            // is valid only until that cursor's next call.
+            return detail::makeCursor<T>([left = self->openCursor(ctx), right = other_self->openCursor(ctx), key_selector,
+                left_head = static_cast<const T*>(nullptr), right_head = static_cast<const T*>(nullptr),
+                started = false, advance_left = false]() mutable -> const T* {
+                if (!started) { left_head = left->next(); right_head = right->next(); started = true; }
+                else if (advance_left) { left_head = left->next(); }
+                else { right_head = right->next(); }
+                if (!left_head && !right_head) return nullptr;
+                advance_left = !right_head || (left_head && !(key_selector(*right_head) < key_selector(*left_head)));
+                return advance_left ? left_head : right_head;
+                });
+            };
+        return chainStreaming<T>(self, cursor_provider, [self, other_self]() {
+            PlanNode node{ "MergeSorted", "streaming two-way merge", std::nullopt, false, {} };
+            node.children.push_back(self->explain());
+            node.children.push_back(other_self->explain());
+            if (node.children[0].estimated_rows && node.children[1].estimated_rows) {
+                node.estimated_rows = *node.children[0].estimated_rows + *node.children[1].estimated_rows;
+            }
+            return node;
+            });
+    }
 
-        std::vector<T> execute() const;
+    // --- dmlinq_sampling ---
+    // Reservoir sampling with Vitter/Li's algorithm L: once the reservoir is full, the number of
+    // rows to pass over before the next replacement is drawn directly, so the random number
+    // generator runs O(count * log(n / count)) times instead of once per row.
+    template <typename T>
+    DmLinq<T> DmLinq<T>::sample(size_t count, uint64_t seed) const {
+        auto self = snapshot();
+        auto new_source_provider = [self, count, seed](const detail::ExecutionContext& ctx) {
+            auto upstream = self->openCursor(ctx);
+            detail::OperatorScope scope(ctx, "Sample", 0);
+            detail::SplitMix64 rng(seed);
+            std::pmr::vector<std::pair<size_t, T>> reservoir(ctx.resource);
+            reservoir.reserve(count);
+            size_t position = 0;
+            const T* row = nullptr;
+            while (reservoir.size() < count && (row = upstream->next()) != nullptr) { reservoir.emplace_back(position++, *row); }
+            if (count != 0 && reservoir.size() == count) {
+                double w = std::exp(std::log(rng.uniform()) / static_cast<double>(count));
+                bool exhausted = false;
+                while (!exhausted) {
+                    size_t gap = detail::geometricGap(rng.uniform(), w);
+                    for (size_t i = 0; i < gap; ++i, ++position) {
+                        if (!upstream->next()) { exhausted = true; break; }
+                    }
+                    // Never pull again once the input has ended; a generator may not expect it.
+                    if (exhausted || (row = upstream->next()) == nullptr) break;
+                    reservoir[rng.below(count)] = { position++, *row };
+                    w *= std::exp(std::log(rng.uniform()) / static_cast<double>(count));
+                }
+            }
+            std::sort(reservoir.begin(), reservoir.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+            Buffer result(ctx.resource);
+            result.reserve(reservoir.size());
+            for (auto& entry : reservoir) { result.push_back(std::move(entry.second)); }
+            scope.finish(result.size(), result.size() * sizeof(T));
+            return result;
+            };
+        return chain<T>(self, new_source_provider, [self, count]() {
+            auto input = self->explain();
+            std::optional<size_t> rows = count;
+            if (input.estimated_rows) { rows = (std::min)(count, *input.estimated_rows); }
+            return detail::planOver("Sample", "reservoir (algorithm L), " + std::to_string(count) + " rows", std::move(input), rows, true);
+            });
+    }
 
-    public:
-        template<typename TFunc> [[nodiscard]] DmLinq<T>& where(TFunc predicate);
-        template <typename TFunc> [[nodiscard]] DmLinq<T>& orderBy(TFunc key_selector, SortDirection direction = SortDirection::ASC);
-        template <typename TFunc> [[nodiscard]] DmLinq<T>& orderByDescending(TFunc key_selector);
-        template <typename TFunc> [[nodiscard]] DmLinq<T>& thenBy(TFunc key_selector, SortDirection direction = SortDirection::ASC);
-        template <typename TFunc> [[nodiscard]] DmLinq<T>& thenByDescending(TFunc key_selector);
-        template <typename TFunc> [[nodiscard]] auto select(TFunc selector) -> DmLinq<std::invoke_result_t<TFunc, const T&>>;
-        template <typename TFunc> [[nodiscard]] auto selectMany(TFunc selector) -> DmLinq<typename std::invoke_result_t<TFunc, const T&>::value_type>;
-        [[nodiscard]] DmLinq<T>& take(size_t count);
-        [[nodiscard]] DmLinq<T>& skip(size_t count);
-        T first();
-        template<typename TFunc> T first(TFunc predicate);
-        std::optional<T> firstOrDefault();
-        template<typename TFunc> std::optional<T> firstOrDefault(TFunc predicate);
-        T last();
-        template<typename TFunc> T last(TFunc predicate);
-        std::optional<T> lastOrDefault();
-        template<typename TFunc> std::optional<T> lastOrDefault(TFunc predicate);
-        T single();
-        template<typename TFunc> T single(TFunc predicate);
-        std::optional<T> singleOrDefault();
-        template<typename TFunc> std::optional<T> singleOrDefault(TFunc predicate);
-        size_t count();
-        template<typename TFunc> size_t count(TFunc predicate);
-        template<typename TFunc> auto sum(TFunc selector) -> std::invoke_result_t<TFunc, const T&>;
-        auto sum() -> T;
-        template<typename TFunc> double average(TFunc selector);
-        double average();
-        T max();
-        T min();
-        bool any();
-        template<typename TFunc> bool any(TFunc predicate);
-        template<typename TFunc> bool all(TFunc predicate);
-        std::vector<T> toVector();
-        std::set<T> toSet();
-        template <typename TFunc> auto toMap(TFunc key_selector) -> std::map<std::invoke_result_t<TFunc, const T&>, T>;
-        template <typename TKeyFunc, typename TValueFunc>
-        auto toMap(TKeyFunc key_selector, TValueFunc value_selector) -> std::map<std::invoke_result_t<TKeyFunc, const T&>, std::invoke_result_t<TValueFunc, const T&>>;
-    };
+    // Bernoulli sampling that draws the gap to the next kept row from a geometric distribution,
+    // one random number per kept row. Skipped rows are only stepped over, never copied or passed
+    // to later operators, so an aggregate over a 1% sample does about 1% of the work.
+    template <typename T>
+    DmLinq<T> DmLinq<T>::sampleFraction(double fraction, uint64_t seed) const {
+        if (!(fraction >= 0.0 && fraction <= 1.0)) { throw std::runtime_error("sampleFraction() fraction must be in [0, 1]."); }
+        auto self = snapshot();
+        auto cursor_provider = [self, fraction, seed](const detail::ExecutionContext& ctx) {
+            return detail::makeCursor<T>([upstream = self->openCursor(ctx), fraction, rng = detail::SplitMix64(seed), exhausted = false]() mutable -> const T* {
+                if (fraction == 0.0 || exhausted) return nullptr;
+                if (fraction < 1.0) {
+                    size_t gap = detail::geometricGap(rng.uniform(), fraction);
+                    for (size_t i = 0; i < gap; ++i) {
+                        if (!upstream->next()) { exhausted = true; return nullptr; }
+                    }
+                }
+                const T* row = upstream->next();
+                exhausted = row == nullptr;
+                return row;
+                });
+            };
+        return chainStreaming<T>(self, cursor_provider, [self, fraction]() {
+            auto input = self->explain();
+            std::optional<size_t> rows;
+            if (input.estimated_rows) { rows = static_cast<size_t>(std::ceil(static_cast<double>(*input.estimated_rows) * fraction)); }
+            return detail::planOver("SampleFraction", "bernoulli p=" + std::to_string(fraction) + ", geometric skips", std::move(input), rows, false);
+            });
+    }
 
-    // ===================================================================================
-    // === Inlined Implementations (replaces all .tpp files) =============================
-    // ===================================================================================
+    // Stratified sampling: an independent reservoir (algorithm R) of up to count_per_key rows per key.
+    template <typename T>
+    template <typename TFunc>
+    DmLinq<T> DmLinq<T>::sampleBy(TFunc key_selector, size_t count_per_key, uint64_t seed) const {
+        using TKey = std::decay_t<std::invoke_result_t<TFunc, const T&>>;
+        auto self = snapshot();
+        auto new_source_provider = [self, key_selector, count_per_key, seed](const detail::ExecutionContext& ctx) {
+            auto upstream = self->openCursor(ctx);
+            detail::OperatorScope scope(ctx, "SampleBy", 0);
+            struct Stratum {
+                size_t seen = 0;
+                std::vector<std::pair<size_t, T>> rows;
+            };
+            detail::SplitMix64 rng(seed);
+            std::pmr::unordered_map<TKey, Stratum> strata(ctx.resource);
+            size_t position = 0;
+            size_t kept = 0;
+            while (const T* row = upstream->next()) {
+                auto& stratum = strata[key_selector(*row)];
+                size_t seen = stratum.seen++;
+                if (seen < count_per_key) {
+                    stratum.rows.emplace_back(position, *row);
+                    ++kept;
+                }
+                else {
+                    size_t slot = rng.below(seen + 1);
+                    if (slot < count_per_key) { stratum.rows[slot] = { position, *row }; }
+                }
+                ++position;
+            }
+            std::pmr::vector<std::pair<size_t, T>> picked(ctx.resource);
+            picked.reserve(kept);
+            for (auto& entry : strata) {
+                for (auto& row : entry.second.rows) { picked.push_back(std::move(row)); }
+            }
+            std::sort(picked.begin(), picked.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+            Buffer result(ctx.resource);
+            result.reserve(picked.size());
+            for (auto& entry : picked) { result.push_back(std::move(entry.second)); }
+            scope.finish(result.size(), result.size() * sizeof(T));
+            return result;
+            };
+        return chain<T>(self, new_source_provider, [self, count_per_key]() {
+            return detail::planOver("SampleBy", "stratified reservoir, " + std::to_string(count_per_key) + " rows per key", self->explain(), std::nullopt, true);
+            });
+    }
 
-    // --- Constructors and Entry Points ---
-    template<typename T>
-    DmLinq<T>::DmLinq(const std::vector<T>& source) {
-        m_source_provider = [source]() { return source; };
+    // --- dmlinq_rolling ---
+    // Rolling aggregates emit one value per full window of the last `size` rows, in O(1) amortized
+    // work per row and O(size) memory. rollingFold needs an invertible fold: remove(acc, row) must
+    // undo add(acc, row) for the oldest row in the window.
+    template <typename T>
+    template <typename TAcc, typename TAddFunc, typename TRemoveFunc>
+    DmLinq<TAcc> DmLinq<T>::rollingFold(size_t size, TAcc seed, TAddFunc add, TRemoveFunc remove) const {
+        if (size == 0) { throw std::runtime_error("rollingFold() window size must be greater than zero."); }
+        auto self = snapshot();
+        auto cursor_provider = [self, size, seed, add, remove](const detail::ExecutionContext& ctx) {
+            return detail::makeCursor<TAcc>([upstream = self->openCursor(ctx), size, add, remove, acc = seed, rows = std::deque<T>()]() mutable -> const TAcc* {
+                if (rows.size() == size) {
+                    acc = remove(std::move(acc), rows.front());
+                    rows.pop_front();
+                }
+                while (rows.size() < size) {
+                    const T* row = upstream->next();
+                    if (!row) return nullptr;
+                    rows.push_back(*row);
+                    acc = add(std::move(acc), rows.back());
+                }
+                return &acc;
+                });
+            };
+        return chainStreaming<TAcc>(self, cursor_provider, [self, size]() {
+            auto input = self->explain();
+            std::optional<size_t> rows;
+            if (input.estimated_rows) { rows = *input.estimated_rows >= size ? *input.estimated_rows - size + 1 : 0; }
+            return detail::planOver("RollingFold", "streaming, window " + std::to_string(size), std::move(input), rows, false);
+            });
     }
-    template<typename T>
-    DmLinq<T>::DmLinq(std::shared_ptr<void> previous_stage, std::function<std::vector<T>()> source_provider)
-        : m_previous_stage(previous_stage), m_source_provider(source_provider) {
+    template <typename T>
+    template <typename TFunc>
+    auto DmLinq<T>::rollingSum(size_t size, TFunc selector) const -> DmLinq<std::invoke_result_t<TFunc, const T&>> {
+        using TValue = std::invoke_result_t<TFunc, const T&>;
+        static_assert(std::is_arithmetic_v<TValue>, "rollingSum() selector must project to an arithmetic type.");
+        auto add = [](TValue acc, const TValue& value) { return acc + value; };
+        auto remove = [](TValue acc, const TValue& value) { return acc - value; };
+        if constexpr (std::is_same_v<TFunc, detail::Identity>) { return rollingFold(size, TValue{}, add, remove); }
+        else { return select(selector).rollingFold(size, TValue{}, add, remove); }
     }
-
     template <typename T>
-    DmLinq<T> from(const std::vector<T>& source) {
-        return DmLinq<T>(source);
+    template <typename TFunc>
+    DmLinq<double> DmLinq<T>::rollingAvg(size_t size, TFunc selector) const {
+        return rollingSum(size, selector).select([size](const auto& sum) { return static_cast<double>(sum) / static_cast<double>(size); });
     }
     template <typename T>
-    DmLinq<T> from(std::vector<T>&& source) {
-        // To keep it simple, we copy. A move-based optimization is possible but more complex.
-        return DmLinq<T>(source);
+    template <typename TFunc>
+    auto DmLinq<T>::rollingMin(size_t size, TFunc selector) const -> DmLinq<std::invoke_result_t<TFunc, const T&>> {
+        using TValue = std::invoke_result_t<TFunc, const T&>;
+        if constexpr (std::is_same_v<TFunc, detail::Identity>) { return rollingExtreme(size, std::less<TValue>(), "RollingMin"); }
+        else { return select(selector).rollingExtreme(size, std::less<TValue>(), "RollingMin"); }
+    }
+    template <typename T>
+    template <typename TFunc>
+    auto DmLinq<T>::rollingMax(size_t size, TFunc selector) const -> DmLinq<std::invoke_result_t<TFunc, const T&>> {
+        using TValue = std::invoke_result_t<TFunc, const T&>;
+        if constexpr (std::is_same_v<TFunc, detail::Identity>) { return rollingExtreme(size, std::greater<TValue>(), "RollingMax"); }
+        else { return select(selector).rollingExtreme(size, std::greater<TValue>(), "RollingMax"); }
+    }
+    // Monotonic deque: holds the rows that can still become the window's extreme, best at the
+    // front; each row is pushed and popped at most once.
+    template <typename T>
+    template <typename TCompare>
+    DmLinq<T> DmLinq<T>::rollingExtreme(size_t size, TCompare compare, const char* op) const {
+        if (size == 0) { throw std::runtime_error("rolling window size must be greater than zero."); }
+        auto self = snapshot();
+        auto cursor_provider = [self, size, compare](const detail::ExecutionContext& ctx) {
+            return detail::makeCursor<T>([upstream = self->openCursor(ctx), size, compare, index = size_t{ 0 },
+                candidates = std::deque<std::pair<size_t, T>>()]() mutable -> const T* {
+                do {
+                    const T* row = upstream->next();
+                    if (!row) return nullptr;
+                    while (!candidates.empty() && !compare(candidates.back().second, *row)) { candidates.pop_back(); }
+                    candidates.emplace_back(index++, *row);
+                    if (candidates.front().first + size <= index - 1) { candidates.pop_front(); }
+                } while (index < size);
+                return &candidates.front().second;
+                });
+            };
+        return chainStreaming<T>(self, cursor_provider, [self, size, op]() {
+            auto input = self->explain();
+            std::optional<size_t> rows;
+            if (input.estimated_rows) { rows = *input.estimated_rows >= size ? *input.estimated_rows - size + 1 : 0; }
+            return detail::planOver(op, "monotonic deque, window " + std::to_string(size), std::move(input), rows, false);
+            });
     }
 
-    // --- dmlinq_execution ---
+    // --- dmlinq_element ---
+    template<typename T> T DmLinq<T>::first() const { detail::QueryGuard guard; auto r = execute(guard); if (r.empty()) throw std::runtime_error("Sequence contains no elements."); return std::move(r.front()); }
+    template<typename T> template<typename TFunc> T DmLinq<T>::first(TFunc predicate) const { return this->where(predicate).first(); }
+    template<typename T> std::optional<T> DmLinq<T>::firstOrDefault() const { detail::QueryGuard guard; auto r = execute(guard); return r.empty() ? std::nullopt : std::optional<T>(std::move(r.front())); }
+    template<typename T> template<typename TFunc> std::optional<T> DmLinq<T>::firstOrDefault(TFunc predicate) const { return this->where(predicate).firstOrDefault(); }
+    template<typename T> T DmLinq<T>::last() const { detail::QueryGuard guard; auto r = execute(guard); if (r.empty()) throw std::runtime_error("Empty sequence"); return std::move(r.back()); }
+    template<typename T> template<typename TFunc> T DmLinq<T>::last(TFunc predicate) const { return this->where(predicate).last(); }
+    template<typename T> std::optional<T> DmLinq<T>::lastOrDefault() const { detail::QueryGuard guard; auto r = execute(guard); return r.empty() ? std::nullopt : std::optional<T>(std::move(r.back())); }
+    template<typename T> template<typename TFunc> std::optional<T> DmLinq<T>::lastOrDefault(TFunc predicate) const { return this->where(predicate).lastOrDefault(); }
+    template<typename T> T DmLinq<T>::single() const { detail::QueryGuard guard; auto r = execute(guard); if (r.size() != 1) throw std::runtime_error("Sequence does not contain exactly one element."); return std::move(r.front()); }
+    template<typename T> template<typename TFunc> T DmLinq<T>::single(TFunc predicate) const { return this->where(predicate).single(); }
+    template<typename T> std::optional<T> DmLinq<T>::singleOrDefault() const { detail::QueryGuard guard; auto r = execute(guard); if (r.size() > 1) throw std::runtime_error("Sequence contains more than one element."); return r.empty() ? std::nullopt : std::optional<T>(std::move(r.front())); }
+    template<typename T> template<typename TFunc> std::optional<T> DmLinq<T>::singleOrDefault(TFunc predicate) const { return this->where(predicate).singleOrDefault(); }
+
+    // --- dmlinq_aggregation ---
+    template<typename T> size_t DmLinq<T>::count() const {
+        auto add = [](size_t& n, const T&) { ++n; };
+        auto merge = [](size_t& n, size_t&& other) { n += other; };
+        if (auto n = parallelFold(size_t{ 0 }, add, merge)) { return *n; }
+        size_t n = 0; forEachRow([&n](const T&) { ++n; return true; }); return n;
+    }
+    template<typename T> template<typename TFunc> size_t DmLinq<T>::count(TFunc predicate) const { return this->where(predicate).count(); }
+    template<typename T> template<typename TFunc> auto DmLinq<T>::sum(TFunc selector) const -> std::invoke_result_t<TFunc, const T&> {
+        using TResult = std::invoke_result_t<TFunc, const T&>;
+        if constexpr (!std::is_arithmetic_v<TResult>) { static_assert(std::is_arithmetic_v<TResult>, "sum() selector must project to an arithmetic type."); }
+        auto add = [&selector](TResult& total, const T& item) { total += selector(item); };
+        auto merge = [](TResult& total, TResult&& other) { total += other; };
+        if (auto total = parallelFold(TResult{}, add, merge)) { return *total; }
+        TResult total{}; forEachRow([&](const T& item) { total += selector(item); return true; }); return total;
+    }
+    template<typename T> auto DmLinq<T>::sum() const -> T {
+        if constexpr (!std::is_arithmetic_v<T>) { static_assert(std::is_arithmetic_v<T>, "sum() requires an arithmetic type."); }
+        return sum(detail::Identity{});
+    }
+    template<typename T> template<typename TFunc> double DmLinq<T>::average(TFunc selector) const {
+        using TResult = std::invoke_result_t<TFunc, const T&>;
+        if constexpr (!std::is_arithmetic_v<TResult>) { static_assert(std::is_arithmetic_v<TResult>, "average() selector must project to an arithmetic type."); }
+        using Totals = std::pair<double, size_t>;
+        auto add = [&selector](Totals& totals, const T& item) { totals.first += static_cast<double>(selector(item)); ++totals.second; };
+        auto merge = [](Totals& totals, Totals&& other) { totals.first += other.first; totals.second += other.second; };
+        Totals totals{ 0.0, 0 };
+        if (auto parallel = parallelFold(totals, add, merge)) { totals = *parallel; }
+        else { forEachRow([&](const T& item) { add(totals, item); return true; }); }
+        return totals.second == 0 ? 0.0 : totals.first / totals.second;
+    }
+    template<typename T> double DmLinq<T>::average() const {
+        if constexpr (!std::is_arithmetic_v<T>) { static_assert(std::is_arithmetic_v<T>, "average() requires an arithmetic type."); }
+        return average(detail::Identity{});
+    }
+    template<typename T> T DmLinq<T>::max() const {
+        std::optional<T> best; forEachRow([&best](const T& item) { if (!best || *best < item) best = item; return true; });
+        if (!best) throw std::runtime_error("Empty sequence");
+        return std::move(*best);
+    }
+    template<typename T> T DmLinq<T>::min() const {
+        std::optional<T> best; forEachRow([&best](const T& item) { if (!best || item < *best) best = item; return true; });
+        if (!best) throw std::runtime_error("Empty sequence");
+        return std::move(*best);
+    }
     template<typename T>
-    std::vector<T> DmLinq<T>::execute() const {
-        std::vector<T> results = m_source_provider();
-        if (!m_filters.empty()) {
-            results.erase(std::remove_if(results.begin(), results.end(),
-                [this](const T& item) {
+    template <typename TAcc, typename TFoldFunc, typename TCombineFunc>
+    TAcc DmLinq<T>::aggregate(TAcc seed, TFoldFunc fold, TCombineFunc combine) const {
+        auto add = [&fold](TAcc& acc, const T& item) { acc = fold(std::move(acc), item); };
+        auto merge = [&combine](TAcc& acc, TAcc&& other) { acc = combine(std::move(acc), std::move(other)); };
+        if (auto parallel = parallelFold(seed, add, merge)) { return std::move(*parallel); }
+        forEachRow([&](const T& item) { add(seed, item); return true; });
+        return seed;
+    }
+
+    // --- dmlinq_parallel ---
+    // Morsel-driven scan of a from() source: the selected rows are cut into morsels of about 256 KiB,
+    // each queued on the NUMA node holding its first page, and every worker accumulates into a state
+    // of its own, seeded on the worker's thread so that first-touch places it on the worker's node.
+    // The partial states are merged in worker order on the calling thread. Returns nullopt when the
+    // query does not qualify, leaving the caller to run serially.
+    template <typename T>
+    template <typename TAcc, typename TAccumulate, typename TMerge>
+    std::optional<TAcc> DmLinq<T>::parallelFold(const TAcc& seed, const TAccumulate& accumulate, const TMerge& merge) const {
+        if (m_parallelism < 2 || m_previous_stage || !m_source_rows || m_sorter || m_skip_count != 0 || m_take_count.has_value()) { return std::nullopt; }
+        const std::vector<T>& rows = *m_source_rows;
+        detail::RowRanges spans = m_source_ranges ? *m_source_ranges : detail::RowRanges{ { 0, rows.size() } };
+        const size_t morsel_rows = (std::max)(size_t{ 1024 }, (size_t{ 256 } << 10) / sizeof(T));
+        std::vector<std::vector<detail::Morsel>> by_node(detail::NumaTopology::nodeCount());
+        size_t morsels = 0;
+        size_t selected = 0;
+        for (const auto& span : spans) {
+            for (size_t begin = span.first; begin < span.second; begin += morsel_rows) {
+                size_t end = (std::min)(span.second, begin + morsel_rows);
+                by_node[detail::NumaTopology::nodeOf(&rows[begin])].push_back(detail::Morsel{ begin, end });
+                selected += end - begin;
+                ++morsels;
+            }
+        }
+        if (morsels < 2) { return std::nullopt; }
+
+        detail::QueryGuard guard;
+        auto ctx = topLevelContext(false, guard);
+        detail::OperatorScope scope(ctx, "ParallelScan", selected);
+        if (ctx.guard) { ctx.guard->scanRows(selected); }
+        size_t workers = (std::min)(m_parallelism, morsels);
+        struct alignas(64) Partial { std::optional<TAcc> state; size_t rows = 0; };
+        std::vector<Partial> partials(workers);
+        detail::runMorsels(by_node, workers, [&](size_t worker, auto& next) {
+            TAcc state = seed;
+            size_t kept = 0;
+            while (const detail::Morsel* morsel = next()) {
+                if (ctx.guard) { ctx.guard->check(); } // cancellation and deadline, once per morsel
+                for (size_t i = morsel->begin; i < morsel->end; ++i) {
+                    const T& row = rows[i];
+                    bool keep = true;
                     for (const auto& filter : m_filters) {
-                        if (!filter(item)) return true; // true means remove
+                        if (!filter(row)) { keep = false; break; }
                     }
-                    return false;
-                }), results.end());
+                    if (!keep) continue;
+                    accumulate(state, row);
+                    ++kept;
+                }
+            }
+            partials[worker].state = std::move(state);
+            partials[worker].rows = kept;
+            });
+        TAcc result = std::move(*partials[0].state);
+        size_t kept = partials[0].rows;
+        for (size_t worker = 1; worker < workers; ++worker) {
+            merge(result, std::move(*partials[worker].state));
+            kept += partials[worker].rows;
         }
-        if (m_sorter) {
-            std::stable_sort(results.begin(), results.end(), m_sorter);
+        scope.finish(kept, 0);
+        return result;
+    }
+
+    // --- dmlinq_quantifiers ---
+    template<typename T> bool DmLinq<T>::any() const { bool found = false; forEachRow([&found](const T&) { found = true; return false; }); return found; }
+    template<typename T> template<typename TFunc> bool DmLinq<T>::any(TFunc predicate) const { bool found = false; forEachRow([&](const T& item) { found = predicate(item); return !found; }); return found; }
+    template<typename T> template<typename TFunc> bool DmLinq<T>::all(TFunc predicate) const { bool holds = true; forEachRow([&](const T& item) { holds = predicate(item); return holds; }); return holds; }
+
+    template <typename T>
+    template <typename TFunc>
+    size_t DmLinq<T>::countDistinct(TFunc key_selector) const {
+        using TKey = std::decay_t<std::invoke_result_t<TFunc, const T&>>;
+        detail::FlatKeyIndex<TKey> seen(executionResource());
+        forEachRow([&](const T& item) { seen.insert(key_selector(item)); return true; });
+        return seen.size();
+    }
+    template <typename T>
+    template <typename TFunc>
+    HyperLogLog DmLinq<T>::toHyperLogLog(TFunc key_selector, uint8_t precision) const {
+        HyperLogLog sketch(precision);
+        auto add = [&key_selector](HyperLogLog& partial, const T& item) { partial.add(key_selector(item)); };
+        auto merge = [](HyperLogLog& partial, HyperLogLog&& other) { partial.merge(other); };
+        if (auto parallel = parallelFold(sketch, add, merge)) { return std::move(*parallel); }
+        forEachRow([&](const T& item) { add(sketch, item); return true; });
+        return sketch;
+    }
+    template <typename T>
+    template <typename TFunc>
+    size_t DmLinq<T>::countDistinctApprox(TFunc key_selector, uint8_t precision) const {
+        return static_cast<size_t>(std::llround(toHyperLogLog(key_selector, precision).estimate()));
+    }
+
+    // One pass collects the projected values; each requested quantile then runs nth_element on the
+    // part of the buffer right of the previous one, so k quantiles cost far less than a full sort.
+    template <typename T>
+    template <typename TFunc>
+    std::vector<double> DmLinq<T>::quantiles(const std::vector<double>& qs, TFunc selector) const {
+        using TValue = std::decay_t<std::invoke_result_t<TFunc, const T&>>;
+        static_assert(std::is_arithmetic_v<TValue>, "quantile() selector must project to an arithmetic type.");
+        for (double q : qs) {
+            if (!(q >= 0.0 && q <= 1.0)) { throw std::runtime_error("quantile must be in [0, 1]."); }
         }
-        if (m_skip_count > 0) {
-            if (m_skip_count >= results.size()) {
-                results.clear();
+        std::pmr::vector<TValue> values(executionResource());
+        forEachRow([&](const T& item) { values.push_back(selector(item)); return true; });
+        if (values.empty()) { throw std::runtime_error("quantile of an empty sequence."); }
+        std::vector<size_t> order(qs.size());
+        std::iota(order.begin(), order.end(), size_t{ 0 });
+        std::sort(order.begin(), order.end(), [&qs](size_t a, size_t b) { return qs[a] < qs[b]; });
+        std::vector<double> result(qs.size());
+        size_t sorted_until = 0; // values[0, sorted_until) are all <= everything after them
+        for (size_t i : order) {
+            double position = qs[i] * static_cast<double>(values.size() - 1);
+            auto lo = static_cast<size_t>(position);
+            auto nth = values.begin() + lo;
+            if (lo >= sorted_until) {
+                std::nth_element(values.begin() + sorted_until, nth, values.end());
+                sorted_until = lo + 1;
             }
-            else {
-                results.erase(results.begin(), results.begin() + m_skip_count);
+            double value = static_cast<double>(*nth);
+            double fraction = position - static_cast<double>(lo);
+            if (fraction > 0.0) {
+                double next = static_cast<double>(*std::min_element(nth + 1, values.end()));
+                value += fraction * (next - value);
             }
+            result[i] = value;
         }
-        if (m_take_count.has_value()) {
-            if (*m_take_count < results.size()) {
-                results.resize(*m_take_count);
+        return result;
+    }
+    template <typename T>
+    template <typename TFunc>
+    double DmLinq<T>::quantile(double q, TFunc selector) const { return quantiles({ q }, selector)[0]; }
+    template <typename T>
+    template <typename TFunc>
+    KllSketch DmLinq<T>::toKllSketch(TFunc selector, size_t k) const {
+        static_assert(std::is_arithmetic_v<std::decay_t<std::invoke_result_t<TFunc, const T&>>>, "quantileApprox() selector must project to an arithmetic type.");
+        KllSketch sketch(k);
+        auto add = [&selector](KllSketch& partial, const T& item) { partial.add(static_cast<double>(selector(item))); };
+        auto merge = [](KllSketch& partial, KllSketch&& other) { partial.merge(other); };
+        if (auto parallel = parallelFold(sketch, add, merge)) { return std::move(*parallel); }
+        forEachRow([&](const T& item) { add(sketch, item); return true; });
+        return sketch;
+    }
+    // Exact counts, then a size-k min-heap over them, so only k entries are ever ordered.
+    template <typename T>
+    template <typename TFunc>
+    auto DmLinq<T>::topFrequent(TFunc key_selector, size_t k) const -> std::vector<std::pair<std::decay_t<std::invoke_result_t<TFunc, const T&>>, size_t>> {
+        detail::QueryGuard guard;
+        auto counts = countBy(key_selector).execute(guard, true);
+        // Ranks by count, then by first appearance; the heap keeps the worst of the current top k at its root.
+        auto better = [&counts](size_t a, size_t b) { return counts[a].second != counts[b].second ? counts[a].second > counts[b].second : a < b; };
+        std::vector<size_t> heap;
+        heap.reserve((std::min)(k, counts.size()));
+        for (size_t i = 0; i < counts.size() && k != 0; ++i) {
+            if (heap.size() < k) {
+                heap.push_back(i);
+                std::push_heap(heap.begin(), heap.end(), better);
+            }
+            else if (better(i, heap.front())) {
+                std::pop_heap(heap.begin(), heap.end(), better);
+                heap.back() = i;
+                std::push_heap(heap.begin(), heap.end(), better);
             }
         }
-        return results;
+        std::sort_heap(heap.begin(), heap.end(), better);
+        std::vector<std::pair<std::decay_t<std::invoke_result_t<TFunc, const T&>>, size_t>> result;
+        result.reserve(heap.size());
+        for (size_t i : heap) { result.push_back(std::move(counts[i])); }
+        return result;
     }
 
-    // --- dmlinq_filtering ---
+    // Space-Saving (Metwally et al.): a key without a counter takes over the smallest one and
+    // inherits its count, so every key whose true frequency exceeds n / counters is reported and
+    // each count overestimates by at most that smallest count. The counters form an indexed
+    // min-heap, making each row O(log counters) however many distinct keys the input has.
     template <typename T>
-    template<typename TFunc>
-    DmLinq<T>& DmLinq<T>::where(TFunc predicate) {
-        m_filters.push_back(predicate);
-        return *this;
+    template <typename TFunc>
+    auto DmLinq<T>::topFrequentApprox(TFunc key_selector, size_t k, size_t counters) const -> std::vector<std::pair<std::decay_t<std::invoke_result_t<TFunc, const T&>>, size_t>> {
+        using TKey = std::decay_t<std::invoke_result_t<TFunc, const T&>>;
+        if (counters == 0) { counters = (std::max)(k * 10, size_t{ 1024 }); }
+        if (counters < k) { throw std::runtime_error("topFrequentApprox() needs at least k counters."); }
+        std::vector<TKey> keys;
+        std::vector<size_t> counts;
+        std::vector<size_t> heap;     // counter slots, smallest count at the root
+        std::vector<size_t> position; // slot -> index in heap
+        std::unordered_map<TKey, size_t> slot_of;
+        auto sift_down = [&](size_t i) {
+            while (true) {
+                size_t smallest = i;
+                for (size_t child = 2 * i + 1; child <= 2 * i + 2 && child < heap.size(); ++child) {
+                    if (counts[heap[child]] < counts[heap[smallest]]) smallest = child;
+                }
+                if (smallest == i) return;
+                std::swap(heap[i], heap[smallest]);
+                position[heap[i]] = i;
+                position[heap[smallest]] = smallest;
+                i = smallest;
+            }
+        };
+        forEachRow([&](const T& item) {
+            TKey key = key_selector(item);
+            auto it = slot_of.find(key);
+            if (it != slot_of.end()) {
+                ++counts[it->second];
+                sift_down(position[it->second]);
+            }
+            else if (keys.size() < counters) {
+                // A new counter of 1 moves up past every parent with a larger count.
+                size_t slot = keys.size();
+                keys.push_back(key);
+                counts.push_back(1);
+                position.push_back(heap.size());
+                heap.push_back(slot);
+                for (size_t i = heap.size() - 1; i > 0 && counts[heap[(i - 1) / 2]] > counts[heap[i]]; i = (i - 1) / 2) {
+                    std::swap(heap[i], heap[(i - 1) / 2]);
+                    position[heap[i]] = i;
+                    position[heap[(i - 1) / 2]] = (i - 1) / 2;
+                }
+                slot_of.emplace(std::move(key), slot);
+            }
+            else {
+                size_t slot = heap.front();
+                slot_of.erase(keys[slot]);
+                keys[slot] = key;
+                ++counts[slot];
+                slot_of.emplace(std::move(key), slot);
+                sift_down(0);
+            }
+            return true;
+            });
+        std::vector<size_t> order(keys.size());
+        std::iota(order.begin(), order.end(), size_t{ 0 });
+        k = (std::min)(k, order.size());
+        std::partial_sort(order.begin(), order.begin() + k, order.end(), [&counts](size_t a, size_t b) {
+            return counts[a] != counts[b] ? counts[a] > counts[b] : a < b;
+            });
+        std::vector<std::pair<TKey, size_t>> result;
+        result.reserve(k);
+        for (size_t i = 0; i < k; ++i) { result.emplace_back(std::move(keys[order[i]]), counts[order[i]]); }
+        return result;
+    }
+
+    template <typename T>
+    template <typename TFunc>
+    Histogram DmLinq<T>::histogram(TFunc selector, size_t bins) const {
+        static_assert(std::is_arithmetic_v<std::decay_t<std::invoke_result_t<TFunc, const T&>>>, "histogram() selector must project to an arithmetic type.");
+        if (bins == 0) { throw std::runtime_error("histogram() needs at least one bin."); }
+        std::pmr::vector<double> values(executionResource());
+        forEachRow([&](const T& item) { values.push_back(static_cast<double>(selector(item))); return true; });
+        Histogram result;
+        result.counts.assign(bins, 0);
+        if (values.empty()) return result;
+        auto range = std::minmax_element(values.begin(), values.end());
+        result.lo = *range.first;
+        result.hi = *range.second;
+        result.width = (result.hi - result.lo) / static_cast<double>(bins);
+        detail::fillHistogram(values.data(), values.size(), result);
+        return result;
+    }
+    // With a known range the values are binned in blocks as they stream past, without being collected.
+    template <typename T>
+    template <typename TFunc>
+    Histogram DmLinq<T>::histogram(TFunc selector, size_t bins, double lo, double hi) const {
+        static_assert(std::is_arithmetic_v<std::decay_t<std::invoke_result_t<TFunc, const T&>>>, "histogram() selector must project to an arithmetic type.");
+        if (bins == 0) { throw std::runtime_error("histogram() needs at least one bin."); }
+        if (!(lo < hi)) { throw std::runtime_error("histogram() range must satisfy lo < hi."); }
+        Histogram result;
+        result.lo = lo;
+        result.hi = hi;
+        result.width = (hi - lo) / static_cast<double>(bins);
+        result.counts.assign(bins, 0);
+        constexpr size_t kBlock = 1024;
+        double block[kBlock];
+        size_t filled = 0;
+        forEachRow([&](const T& item) {
+            block[filled++] = static_cast<double>(selector(item));
+            if (filled == kBlock) {
+                detail::fillHistogram(block, filled, result);
+                filled = 0;
+            }
+            return true;
+            });
+        detail::fillHistogram(block, filled, result);
+        return result;
     }
 
-    // --- dmlinq_sorting ---
     template <typename T>
     template <typename TFunc>
-    DmLinq<T>& DmLinq<T>::orderBy(TFunc key_selector, SortDirection direction) {
-        using TKey = std::invoke_result_t<TFunc, const T&>;
-        m_sorter = [key_selector, direction](const T& a, const T& b) {
-            TKey keyA = key_selector(a);
-            TKey keyB = key_selector(b);
-            return (direction == SortDirection::ASC) ? (keyA < keyB) : (keyB < keyA);
+    double DmLinq<T>::quantileApprox(double q, TFunc selector, size_t k) const { return toKllSketch(selector, k).quantile(q); }
+    template <typename T>
+    template <typename TFunc>
+    std::vector<double> DmLinq<T>::quantilesApprox(const std::vector<double>& qs, TFunc selector, size_t k) const { return toKllSketch(selector, k).quantiles(qs); }
+
+    // --- dmlinq_conversion ---
+    template <typename T> std::vector<T> DmLinq<T>::toVector() const& {
+        detail::QueryGuard guard;
+        auto r = execute(guard);
+        return std::vector<T>(std::make_move_iterator(r.begin()), std::make_move_iterator(r.end()));
+    }
+    template <typename T> std::vector<T> DmLinq<T>::toVector() && {
+        detail::QueryGuard guard;
+        auto r = execute(guard, true);
+        return std::vector<T>(std::make_move_iterator(r.begin()), std::make_move_iterator(r.end()));
+    }
+    // Streams rows into the result as they are produced, so a streaming query that hits a limit
+    // still returns its prefix. Queries that materialize (e.g. orderBy) return nothing in that case.
+    template <typename T> PartialResult<std::vector<T>> DmLinq<T>::tryToVector() const {
+        PartialResult<std::vector<T>> result;
+        try {
+            forEachRow([&result](const T& row) { result.value.push_back(row); return true; });
+        }
+        catch (const QueryCancelled& e) {
+            result.status = e.status();
+        }
+        return result;
+    }
+    template <typename T> AsyncQuery<std::vector<T>> DmLinq<T>::toVectorAsync(size_t batch_size) const {
+        if (batch_size == 0) { throw std::runtime_error("toVectorAsync() batch size must be greater than zero."); }
+        auto run = std::make_shared<detail::AsyncRun<DmLinq<T>, T>>();
+        run->query = snapshot();
+        auto result = std::make_shared<std::vector<T>>();
+        auto step = [run, result, batch_size]() {
+            if (!run->cursor) { run->cursor = run->query->openCursor(run->query->topLevelContext(false, run->guard)); }
+            for (size_t i = 0; i < batch_size; ++i) {
+                const T* row = run->cursor->next();
+                if (!row) { run->cursor.reset(); return true; }
+                result->push_back(*row);
+            }
+            return false;
+            };
+        return AsyncQuery<std::vector<T>>(step, result);
+    }
+    template <typename T> template <typename TFunc> AsyncQuery<size_t> DmLinq<T>::forEachAsync(TFunc action, size_t batch_size) const {
+        if (batch_size == 0) { throw std::runtime_error("forEachAsync() batch size must be greater than zero."); }
+        auto run = std::make_shared<detail::AsyncRun<DmLinq<T>, T>>();
+        run->query = snapshot();
+        auto visited = std::make_shared<size_t>(0);
+        auto step = [run, visited, action, batch_size]() mutable {
+            if (!run->cursor) { run->cursor = run->query->openCursor(run->query->topLevelContext(false, run->guard)); }
+            for (size_t i = 0; i < batch_size; ++i) {
+                const T* row = run->cursor->next();
+                if (!row) { run->cursor.reset(); return true; }
+                action(*row);
+                ++*visited;
+            }
+            return false;
             };
+        return AsyncQuery<size_t>(step, visited);
+    }
+    template <typename T> template <typename TValueFunc>
+    auto DmLinq<T>::materialize(TValueFunc value_selector) const -> MaterializedView<T, std::invoke_result_t<TValueFunc, const T&>> {
+        return materializeBy([](const T&) { return detail::NoKey{}; }, value_selector);
+    }
+    template <typename T> template <typename TKeyFunc, typename TValueFunc>
+    auto DmLinq<T>::materializeBy(TKeyFunc key_selector, TValueFunc value_selector) const
+        -> MaterializedView<T, std::invoke_result_t<TValueFunc, const T&>, std::decay_t<std::invoke_result_t<TKeyFunc, const T&>>> {
+        using TValue = std::invoke_result_t<TValueFunc, const T&>;
+        using TKey = std::decay_t<std::invoke_result_t<TKeyFunc, const T&>>;
+        static_assert(std::is_arithmetic_v<TValue>, "materialize() value selector must project to an arithmetic type.");
+        if (m_skip_count > 0 || m_take_count.has_value()) {
+            throw std::runtime_error("materialize() cannot maintain a query with skip() or take() incrementally.");
+        }
+        // Deltas only pass through this stage's where() predicates, so nothing else may decide membership.
+        if (m_previous_stage || m_source_ranges) {
+            throw std::runtime_error("materialize() requires a from() source filtered only by where(); index probes and earlier operators cannot be applied to deltas.");
+        }
+        auto accepts = [filters = m_filters](const T& row) {
+            for (const auto& filter : filters) {
+                if (!filter(row)) return false;
+            }
+            return true;
+        };
+        MaterializedView<T, TValue, TKey> view(accepts, key_selector, value_selector);
+        forEachRow([&view](const T& row) { view.insert(row); return true; });
+        return view;
+    }
+    template <typename T> std::set<T> DmLinq<T>::toSet() const { detail::QueryGuard guard; auto r = execute(guard); return std::set<T>(std::make_move_iterator(r.begin()), std::make_move_iterator(r.end())); }
+    template <typename T> template <typename TFunc> auto DmLinq<T>::toMap(TFunc key_selector) const -> std::map<std::invoke_result_t<TFunc, const T&>, T> {
+        using TKey = std::invoke_result_t<TFunc, const T&>; detail::QueryGuard guard; auto source = execute(guard); std::map<TKey, T> result; for (auto& item : source) { result.emplace(key_selector(item), std::move(item)); } return result;
+    }
+    template <typename T> template <typename TKeyFunc, typename TValueFunc> auto DmLinq<T>::toMap(TKeyFunc key_selector, TValueFunc value_selector) const -> std::map<std::invoke_result_t<TKeyFunc, const T&>, std::invoke_result_t<TValueFunc, const T&>> {
+        using TKey = std::invoke_result_t<TKeyFunc, const T&>; using TValue = std::invoke_result_t<TValueFunc, const T&>; detail::QueryGuard guard; auto source = execute(guard); std::map<TKey, TValue> result; for (const auto& item : source) { result.emplace(key_selector(item), value_selector(item)); } return result;
+    }
+
+    // --- dmlinq_compiled ---
+    template <typename T>
+    template <typename TValue>
+    QueryParam<TValue> CompiledQuery<T>::param(const std::string& name) {
+        if (std::any_of(m_params->begin(), m_params->end(), [&name](const detail::ParamDecl& param) { return param.name == name; })) {
+            throw std::runtime_error("Duplicate query parameter: " + name);
+        }
+        m_params->push_back(detail::ParamDecl{ name, std::type_index(typeid(TValue)) });
+        return QueryParam<TValue>{ m_params->size() - 1 };
+    }
+    template <typename T>
+    template <typename TFunc>
+    CompiledQuery<T>& CompiledQuery<T>::where(TFunc predicate) {
+        if constexpr (std::is_invocable_r_v<bool, TFunc&, const T&, const QueryArgs&>) { m_filters.emplace_back(predicate); }
+        else { m_filters.emplace_back([predicate](const T& item, const QueryArgs&) { return predicate(item); }); }
         return *this;
     }
     template <typename T>
     template <typename TFunc>
-    DmLinq<T>& DmLinq<T>::orderByDescending(TFunc key_selector) { return orderBy(key_selector, SortDirection::DESC); }
+    CompiledQuery<T>& CompiledQuery<T>::orderBy(TFunc key_selector, SortDirection direction) { m_sorter.clear(); m_sorter.add(key_selector, direction); return *this; }
+    template <typename T>
+    template <typename TFunc>
+    CompiledQuery<T>& CompiledQuery<T>::orderByDescending(TFunc key_selector) { return orderBy(key_selector, SortDirection::DESC); }
     template <typename T>
     template <typename TFunc>
-    DmLinq<T>& DmLinq<T>::thenBy(TFunc key_selector, SortDirection direction) {
+    CompiledQuery<T>& CompiledQuery<T>::thenBy(TFunc key_selector, SortDirection direction) {
         if (!m_sorter) { return orderBy(key_selector, direction); }
-        using TKey = std::invoke_result_t<TFunc, const T&>;
-        auto previous_sorter = m_sorter;
-        m_sorter = [previous_sorter, key_selector, direction](const T& a, const T& b) {
-            if (previous_sorter(a, b)) return true;
-            if (previous_sorter(b, a)) return false;
-            TKey keyA = key_selector(a);
-            TKey keyB = key_selector(b);
-            return (direction == SortDirection::ASC) ? (keyA < keyB) : (keyB < keyA);
-            };
+        m_sorter.add(key_selector, direction);
         return *this;
     }
     template <typename T>
     template <typename TFunc>
-    DmLinq<T>& DmLinq<T>::thenByDescending(TFunc key_selector) { return thenBy(key_selector, SortDirection::DESC); }
+    CompiledQuery<T>& CompiledQuery<T>::thenByDescending(TFunc key_selector) { return thenBy(key_selector, SortDirection::DESC); }
+    template <typename T>
+    CompiledQuery<T>& CompiledQuery<T>::skip(size_t count) { m_skip_count = count; m_skip_param.reset(); return *this; }
+    template <typename T>
+    CompiledQuery<T>& CompiledQuery<T>::skip(QueryParam<size_t> count) { m_skip_param = count; return *this; }
+    template <typename T>
+    CompiledQuery<T>& CompiledQuery<T>::take(size_t count) { m_take_count = count; m_take_param.reset(); return *this; }
+    template <typename T>
+    CompiledQuery<T>& CompiledQuery<T>::take(QueryParam<size_t> count) { m_take_param = count; return *this; }
 
-    // --- dmlinq_projection ---
     template <typename T>
-    template <typename TFunc>
-    auto DmLinq<T>::select(TFunc selector) -> DmLinq<std::invoke_result_t<TFunc, const T&>> {
-        using TResult = std::invoke_result_t<TFunc, const T&>;
-        auto self = std::make_shared<DmLinq<T>>(*this);
-        auto new_source_provider = [self, selector]() {
-            auto source = self->execute();
-            std::vector<TResult> result;
-            result.reserve(source.size());
-            for (const auto& item : source) { result.push_back(selector(item)); }
-            return result;
-            };
-        return DmLinq<TResult>(self, new_source_provider);
+    bool CompiledQuery<T>::accepts(const T& item, const QueryArgs& args) const {
+        for (const auto& filter : m_filters) {
+            if (!filter(item, args)) return false;
+        }
+        return true;
     }
     template <typename T>
-    template <typename TFunc>
-    auto DmLinq<T>::selectMany(TFunc selector) -> DmLinq<typename std::invoke_result_t<TFunc, const T&>::value_type> {
-        using TResultVector = std::invoke_result_t<TFunc, const T&>;
-        using TResult = typename TResultVector::value_type;
-        auto self = std::make_shared<DmLinq<T>>(*this);
-        auto new_source_provider = [self, selector]() {
-            auto source = self->execute();
-            std::vector<TResult> result;
+    std::vector<T> CompiledQuery<T>::execute(const std::vector<T>& source, const QueryArgs& args, std::pmr::memory_resource* resource) const {
+        size_t skip_count = m_skip_param ? args.get(*m_skip_param) : m_skip_count;
+        std::optional<size_t> take_count = m_take_param ? std::optional<size_t>(args.get(*m_take_param)) : m_take_count;
+        std::vector<T> results;
+        if (!m_sorter) {
+            // Unsorted: survivors are copied straight into the result and the scan stops at take.
+            size_t skipped = 0;
             for (const auto& item : source) {
-                auto sub_sequence = selector(item);
-                result.insert(result.end(), sub_sequence.begin(), sub_sequence.end());
+                if (take_count.has_value() && results.size() >= *take_count) break;
+                if (!accepts(item, args)) continue;
+                if (skipped < skip_count) { ++skipped; continue; }
+                results.push_back(item);
             }
-            return result;
-            };
-        return DmLinq<TResult>(self, new_source_provider);
+            return results;
+        }
+        std::pmr::vector<T> matched(resource ? resource : std::pmr::get_default_resource());
+        for (const auto& item : source) {
+            if (accepts(item, args)) matched.push_back(item);
+        }
+        // Same choice as DmLinq::execute(): a take() much smaller than the input only orders its prefix.
+        if (take_count.has_value()) {
+            size_t k = *take_count > (std::numeric_limits<size_t>::max)() - skip_count ? (std::numeric_limits<size_t>::max)() : skip_count + *take_count;
+            if (detail::preferTopK(k, matched.size())) { detail::stableTopK(matched, k, m_sorter); }
+            else { detail::stableSort(matched, m_sorter); }
+        }
+        else {
+            detail::stableSort(matched, m_sorter);
+        }
+        size_t first = (std::min)(skip_count, matched.size());
+        size_t last = take_count.has_value() && *take_count < matched.size() - first ? first + *take_count : matched.size();
+        results.assign(std::make_move_iterator(matched.begin() + first), std::make_move_iterator(matched.begin() + last));
+        return results;
     }
-
-    // --- dmlinq_partitioning ---
     template <typename T>
-    DmLinq<T>& DmLinq<T>::take(size_t count) { m_take_count = count; return *this; }
-    template <typename T>
-    DmLinq<T>& DmLinq<T>::skip(size_t count) { m_skip_count = count; return *this; }
+    size_t CompiledQuery<T>::count(const std::vector<T>& source, const QueryArgs& args) const {
+        size_t skip_count = m_skip_param ? args.get(*m_skip_param) : m_skip_count;
+        std::optional<size_t> take_count = m_take_param ? std::optional<size_t>(args.get(*m_take_param)) : m_take_count;
+        size_t matched = static_cast<size_t>(std::count_if(source.begin(), source.end(), [&](const T& item) { return accepts(item, args); }));
+        matched = matched > skip_count ? matched - skip_count : 0;
+        return take_count.has_value() ? (std::min)(matched, *take_count) : matched;
+    }
 
-    // --- dmlinq_element ---
-    template<typename T> T DmLinq<T>::first() { auto r = execute(); if (r.empty()) throw std::runtime_error("Sequence contains no elements."); return r.front(); }
-    template<typename T> template<typename TFunc> T DmLinq<T>::first(TFunc predicate) { return this->where(predicate).first(); }
-    template<typename T> std::optional<T> DmLinq<T>::firstOrDefault() { auto r = execute(); return r.empty() ? std::nullopt : std::optional<T>(r.front()); }
-    template<typename T> template<typename TFunc> std::optional<T> DmLinq<T>::firstOrDefault(TFunc predicate) { return this->where(predicate).firstOrDefault(); }
-    template<typename T> T DmLinq<T>::last() { auto r = execute(); if (r.empty()) throw std::runtime_error("Empty sequence"); return r.back(); }
-    template<typename T> template<typename TFunc> T DmLinq<T>::last(TFunc predicate) { return this->where(predicate).last(); }
-    template<typename T> std::optional<T> DmLinq<T>::lastOrDefault() { auto r = execute(); return r.empty() ? std::nullopt : std::optional<T>(r.back()); }
-    template<typename T> template<typename TFunc> std::optional<T> DmLinq<T>::lastOrDefault(TFunc predicate) { return this->where(predicate).lastOrDefault(); }
-    template<typename T> T DmLinq<T>::single() { auto r = execute(); if (r.size() != 1) throw std::runtime_error("Sequence does not contain exactly one element."); return r.front(); }
-    template<typename T> template<typename TFunc> T DmLinq<T>::single(TFunc predicate) { return this->where(predicate).single(); }
-    template<typename T> std::optional<T> DmLinq<T>::singleOrDefault() { auto r = execute(); if (r.size() > 1) throw std::runtime_error("Sequence contains more than one element."); return r.empty() ? std::nullopt : std::optional<T>(r.front()); }
-    template<typename T> template<typename TFunc> std::optional<T> DmLinq<T>::singleOrDefault(TFunc predicate) { return this->where(predicate).singleOrDefault(); }
 
-    // --- dmlinq_aggregation ---
-    template<typename T> size_t DmLinq<T>::count() { return execute().size(); }
-    template<typename T> template<typename TFunc> size_t DmLinq<T>::count(TFunc predicate) { return this->where(predicate).count(); }
-    template<typename T> template<typename TFunc> auto DmLinq<T>::sum(TFunc selector) -> std::invoke_result_t<TFunc, const T&> {
+    // --- dmlinq_push ---
+    // Downstream stages are held by their upstream's fanout, so a chain stays alive as long as its
+    // source does, even after the intermediate PushQuery handles are gone.
+    template <typename T>
+    template <typename TResult, typename TAttach>
+    PushQuery<TResult> PushQuery<T>::chain(TAttach attach) const {
+        auto next = std::make_shared<detail::PushFanout<TResult>>();
+        m_out->attach(attach(next));
+        return PushQuery<TResult>(next);
+    }
+    template <typename T>
+    template <typename TFunc>
+    PushQuery<T> PushQuery<T>::where(TFunc predicate) const {
+        return chain<T>([predicate](std::shared_ptr<detail::PushFanout<T>> next) {
+            return [predicate, next](const T& value) { if (predicate(value)) next->emit(value); };
+            });
+    }
+    template <typename T>
+    template <typename TFunc>
+    auto PushQuery<T>::select(TFunc selector) const -> PushQuery<std::invoke_result_t<TFunc, const T&>> {
         using TResult = std::invoke_result_t<TFunc, const T&>;
-        if constexpr (!std::is_arithmetic_v<TResult>) { static_assert(std::is_arithmetic_v<TResult>, "sum() selector must project to an arithmetic type."); }
-        auto source = execute(); TResult total{}; for (const auto& item : source) { total += selector(item); } return total;
+        return chain<TResult>([selector](std::shared_ptr<detail::PushFanout<TResult>> next) {
+            return [selector, next](const T& value) { next->emit(selector(value)); };
+            });
     }
-    template<typename T> auto DmLinq<T>::sum() -> T {
-        if constexpr (!std::is_arithmetic_v<T>) { static_assert(std::is_arithmetic_v<T>, "sum() requires an arithmetic type."); }
-        auto source = execute(); return std::accumulate(source.begin(), source.end(), T{});
+    template <typename T>
+    PushQuery<T> PushQuery<T>::skip(size_t count) const {
+        return chain<T>([count](std::shared_ptr<detail::PushFanout<T>> next) {
+            return [count, next, seen = std::make_shared<size_t>(0)](const T& value) {
+                if (*seen < count) { ++*seen; return; }
+                next->emit(value);
+                };
+            });
     }
-    template<typename T> template<typename TFunc> double DmLinq<T>::average(TFunc selector) {
-        auto source = execute(); if (source.empty()) return 0.0;
-        double total_sum = 0.0; using TResult = std::invoke_result_t<TFunc, const T&>;
-        if constexpr (!std::is_arithmetic_v<TResult>) { static_assert(std::is_arithmetic_v<TResult>, "average() selector must project to an arithmetic type."); }
-        for (const auto& item : source) { total_sum += static_cast<double>(selector(item)); }
-        return total_sum / source.size();
+    template <typename T>
+    PushQuery<T> PushQuery<T>::take(size_t count) const {
+        return chain<T>([count](std::shared_ptr<detail::PushFanout<T>> next) {
+            return [count, next, passed = std::make_shared<size_t>(0)](const T& value) {
+                if (*passed >= count) return;
+                ++*passed;
+                next->emit(value);
+                };
+            });
     }
-    template<typename T> double DmLinq<T>::average() {
-        if constexpr (!std::is_arithmetic_v<T>) { static_assert(std::is_arithmetic_v<T>, "average() requires an arithmetic type."); }
-        auto source = execute(); if (source.empty()) return 0.0;
-        double total_sum = 0.0; for (const auto& item : source) { total_sum += static_cast<double>(item); }
-        return total_sum / source.size();
+    template <typename T>
+    template <typename TFunc>
+    void PushQuery<T>::subscribe(TFunc callback) const {
+        m_out->attach([callback](const T& value) mutable { callback(value); });
+    }
+    template <typename T>
+    PushAggregate<size_t> PushQuery<T>::count() const {
+        return aggregate(size_t{ 0 }, [](size_t n, const T&) { return n + 1; });
+    }
+    template <typename T>
+    template <typename TFunc>
+    auto PushQuery<T>::sum(TFunc selector) const -> PushAggregate<std::invoke_result_t<TFunc, const T&>> {
+        using TValue = std::invoke_result_t<TFunc, const T&>;
+        static_assert(std::is_arithmetic_v<TValue>, "sum() selector must project to an arithmetic type.");
+        return aggregate(TValue{}, [selector](TValue total, const T& value) { return total + selector(value); });
+    }
+    template <typename T>
+    template <typename TFunc>
+    PushAggregate<double> PushQuery<T>::average(TFunc selector) const {
+        auto result = std::make_shared<double>(0.0);
+        m_out->attach([selector, result, total = 0.0, n = size_t{ 0 }](const T& value) mutable {
+            total += static_cast<double>(selector(value));
+            *result = total / static_cast<double>(++n);
+            });
+        return PushAggregate<double>(result);
+    }
+    template <typename T>
+    template <typename TFunc>
+    auto PushQuery<T>::min(TFunc selector) const -> PushAggregate<std::optional<std::invoke_result_t<TFunc, const T&>>> {
+        using TValue = std::invoke_result_t<TFunc, const T&>;
+        return aggregate(std::optional<TValue>(), [selector](std::optional<TValue> best, const T& value) {
+            auto candidate = selector(value);
+            if (!best || candidate < *best) best = std::move(candidate);
+            return best;
+            });
+    }
+    template <typename T>
+    template <typename TFunc>
+    auto PushQuery<T>::max(TFunc selector) const -> PushAggregate<std::optional<std::invoke_result_t<TFunc, const T&>>> {
+        using TValue = std::invoke_result_t<TFunc, const T&>;
+        return aggregate(std::optional<TValue>(), [selector](std::optional<TValue> best, const T& value) {
+            auto candidate = selector(value);
+            if (!best || *best < candidate) best = std::move(candidate);
+            return best;
+            });
+    }
+    template <typename T>
+    template <typename TAcc, typename TFoldFunc>
+    PushAggregate<TAcc> PushQuery<T>::aggregate(TAcc seed, TFoldFunc fold) const {
+        auto result = std::make_shared<TAcc>(std::move(seed));
+        m_out->attach([fold, result](const T& value) { *result = fold(std::move(*result), value); });
+        return PushAggregate<TAcc>(result);
+    }
+    template <typename T>
+    template <typename TKeyFunc, typename TAcc, typename TFoldFunc>
+    auto PushQuery<T>::aggregateBy(TKeyFunc key_selector, TAcc seed, TFoldFunc fold) const
+        -> PushAggregate<std::unordered_map<std::decay_t<std::invoke_result_t<TKeyFunc, const T&>>, TAcc>> {
+        using TKey = std::decay_t<std::invoke_result_t<TKeyFunc, const T&>>;
+        auto result = std::make_shared<std::unordered_map<TKey, TAcc>>();
+        m_out->attach([key_selector, seed, fold, result](const T& value) {
+            auto slot = result->try_emplace(key_selector(value), seed).first;
+            slot->second = fold(std::move(slot->second), value);
+            });
+        return PushAggregate<std::unordered_map<TKey, TAcc>>(result);
     }
-    template<typename T> T DmLinq<T>::max() { auto r = execute(); if (r.empty()) throw std::runtime_error("Empty sequence"); return *std::max_element(r.begin(), r.end()); }
-    template<typename T> T DmLinq<T>::min() { auto r = execute(); if (r.empty()) throw std::runtime_error("Empty sequence"); return *std::min_element(r.begin(), r.end()); }
 
-    // --- dmlinq_quantifiers ---
-    template<typename T> bool DmLinq<T>::any() { return !execute().empty(); }
-    template<typename T> template<typename TFunc> bool DmLinq<T>::any(TFunc predicate) { auto r = execute(); return std::any_of(r.begin(), r.end(), predicate); }
-    template<typename T> template<typename TFunc> bool DmLinq<T>::all(TFunc predicate) { auto r = execute(); return std::all_of(r.begin(), r.end(), predicate); }
 
-    // --- dmlinq_conversion ---
-    template <typename T> std::vector<T> DmLinq<T>::toVector() { return execute(); }
-    template <typename T> std::set<T> DmLinq<T>::toSet() { auto r = execute(); return std::set<T>(r.begin(), r.end()); }
-    template <typename T> template <typename TFunc> auto DmLinq<T>::toMap(TFunc key_selector) -> std::map<std::invoke_result_t<TFunc, const T&>, T> {
-        using TKey = std::invoke_result_t<TFunc, const T&>; auto source = execute(); std::map<TKey, T> result; for (const auto& item : source) { result.emplace(key_selector(item), item); } return result;
+    // --- dmlinq_views ---
+    template <typename T, typename TValue, typename TKey>
+    void MaterializedView<T, TValue, TKey>::insert(const T& row) {
+        if (!m_accepts(row)) return;
+        TValue value = m_value_selector(row);
+        m_totals.add(value);
+        if constexpr (kGrouped) { m_groups[m_key_selector(row)].add(value); }
     }
-    template <typename T> template <typename TKeyFunc, typename TValueFunc> auto DmLinq<T>::toMap(TKeyFunc key_selector, TValueFunc value_selector) -> std::map<std::invoke_result_t<TKeyFunc, const T&>, std::invoke_result_t<TValueFunc, const T&>> {
-        using TKey = std::invoke_result_t<TKeyFunc, const T&>; using TValue = std::invoke_result_t<TValueFunc, const T&>; auto source = execute(); std::map<TKey, TValue> result; for (const auto& item : source) { result.emplace(key_selector(item), value_selector(item)); } return result;
+    template <typename T, typename TValue, typename TKey>
+    void MaterializedView<T, TValue, TKey>::erase(const T& row) {
+        if (!m_accepts(row)) return;
+        TValue value = m_value_selector(row);
+        if constexpr (kGrouped) {
+            auto it = m_groups.find(m_key_selector(row));
+            if (it == m_groups.end() || !it->second.remove(value)) { throw std::runtime_error("MaterializedView::erase() of a row that is not in the view."); }
+            if (it->second.count() == 0) m_groups.erase(it);
+            m_totals.remove(value);
+        }
+        else {
+            if (!m_totals.remove(value)) { throw std::runtime_error("MaterializedView::erase() of a row that is not in the view."); }
+        }
     }
 
 } // namespace dmlinq
 
-#endif // __DMLINQ_HPP_INCLUDE__
\ No newline at end of file
+namespace std {
+    template <typename T>
+    struct hash<dmlinq::instrument::Counted<T>> {
+        size_t operator()(const dmlinq::instrument::Counted<T>& value) const { return std::hash<T>{}(value.get()); }
+    };
+} // namespace std
+
+#endif // __DMLINQ_HPP_INCLUDE__
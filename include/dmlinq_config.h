@@ -24,5 +24,7 @@
 
 #define DMLINQ_VERSION "1.0.1"
 /* #undef USE_DMLINQ */
+/* #undef DMLINQ_ENABLE_PROFILING */
+/* #undef DMLINQ_ENABLE_NUMA */
 
 #endif // __DMLINQ_CONFIG_H_INCLUDE__
@@ -0,0 +1,60 @@
+#ifndef __DMLINQ_FORMAT_HPP_INCLUDE__
+#define __DMLINQ_FORMAT_HPP_INCLUDE__
+
+// Text rendering of dmlinq query plans on top of the bundled dmformat library.
+// Kept out of dmlinq.hpp so the core header has no dependency on dmformat.
+
+#include "dmlinq.hpp"
+#include "dmformat.h"
+
+#include <string>
+
+namespace dmlinq {
+
+    namespace detail {
+        inline void formatPlanNode(fmt::memory_buffer& out, const PlanNode& node, size_t depth) {
+            fmt::format_to(out, "{:>{}}{}", "", depth * 2, node.op);
+            if (!node.algorithm.empty()) { fmt::format_to(out, ": {}", node.algorithm); }
+            if (node.estimated_rows.has_value()) { fmt::format_to(out, " (rows~{})", *node.estimated_rows); }
+            else { fmt::format_to(out, " (rows~?)"); }
+            if (node.materializes) { fmt::format_to(out, " [materialize]"); }
+            fmt::format_to(out, "\n");
+            for (const auto& child : node.children) { formatPlanNode(out, child, depth + 1); }
+        }
+    } // namespace detail
+
+    // One line per operator, inputs indented below the operator that consumes them.
+    inline std::string toString(const PlanNode& plan) {
+        fmt::memory_buffer out;
+        detail::formatPlanNode(out, plan, 0);
+        return fmt::to_string(out);
+    }
+
+    // EXPLAIN ANALYZE style table, one row per operator in the order they completed.
+    inline std::string toString(const QueryProfile& profile) {
+        fmt::memory_buffer out;
+        fmt::format_to(out, "{:<14}{:>10}{:>10}{:>12}{:>14}{:>8}{:>12}{:>12}\n",
+            "operator", "rows_in", "rows_out", "wall_ns", "cycles", "allocs", "bytes_alloc", "bytes_copy");
+        for (const auto& op : profile.operators()) {
+            fmt::format_to(out, "{:<14}{:>10}{:>10}{:>12}{:>14}{:>8}{:>12}{:>12}\n",
+                op.op, op.rows_in, op.rows_out, op.wall_ns, op.cycles, op.allocations, op.bytes_allocated, op.bytes_copied);
+        }
+        return fmt::to_string(out);
+    }
+
+} // namespace dmlinq
+
+namespace fmt {
+    template <>
+    struct formatter<dmlinq::PlanNode> {
+        template <typename ParseContext>
+        constexpr auto parse(ParseContext& ctx) { return ctx.begin(); }
+
+        template <typename FormatContext>
+        auto format(const dmlinq::PlanNode& plan, FormatContext& ctx) {
+            return format_to(ctx.out(), "{}", dmlinq::toString(plan));
+        }
+    };
+} // namespace fmt
+
+#endif // __DMLINQ_FORMAT_HPP_INCLUDE__
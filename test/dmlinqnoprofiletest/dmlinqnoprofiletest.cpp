@@ -0,0 +1,47 @@
+﻿// 关闭逐算子性能统计编译：即使配置打开了该选项，这里也强制关闭
+#include "dmlinq_config.h"
+#undef DMLINQ_ENABLE_PROFILING
+#include "dmlinq.hpp" // 引入我们要测试的库
+#include "gtest.h"    // 引入 gtest
+
+#include <numeric>
+#include <type_traits>
+#include <vector>
+
+// 关闭时统计钩子不占空间、不做任何事
+static_assert(!dmlinq::QueryProfile::enabled(), "profiling must be compiled out in this test");
+static_assert(std::is_empty_v<dmlinq::detail::OperatorScope>, "OperatorScope must be an empty shell without profiling");
+static_assert(std::is_trivially_destructible_v<dmlinq::detail::OperatorScope>, "OperatorScope must have no teardown without profiling");
+
+class frame_dmlinq_noprofile : public testing::Test
+{
+public:
+    virtual void SetUp() override
+    {
+        values.resize(1000);
+        std::iota(values.begin(), values.end(), 0);
+    }
+protected:
+    std::vector<int> values;
+};
+
+TEST_F(frame_dmlinq_noprofile, Profiling_CompiledOut)
+{
+    using namespace dmlinq;
+
+    // 附加 profile 的查询照常执行，但报告保持为空
+    QueryProfile profile;
+    auto result = from(values)
+        .where([](const int& n) { return n % 2 == 0; })
+        .orderByDescending([](const int& n) { return n; })
+        .take(3)
+        .withProfiling(profile)
+        .toVector();
+    EXPECT_EQ(result, (std::vector<int>{ 998, 996, 994 }));
+    EXPECT_TRUE(profile.operators().empty());
+    EXPECT_EQ(profile.totalWallNs(), 0u);
+
+    auto doubled = from(values).select([](const int& n) { return n * 2; }).withProfiling(profile);
+    EXPECT_EQ(doubled.sum(), 999000);
+    EXPECT_TRUE(profile.operators().empty());
+}
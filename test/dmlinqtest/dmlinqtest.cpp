@@ -1,10 +1,52 @@
-﻿#include "dmlinq.hpp" // 引入我们要测试的库
+﻿// 测试中打开逐算子性能统计
+#ifndef DMLINQ_ENABLE_PROFILING
+#define DMLINQ_ENABLE_PROFILING
+#endif
+#include "dmlinq.hpp" // 引入我们要测试的库
+#include "dmlinq_format.hpp"
 #include "gtest.h"    // 引入 gtest
 
 #include <string>
 #include <vector>
 #include <set>
 #include <map>
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <deque>
+#include <functional>
+#include <numeric>
+#include <optional>
+
+// 统计测试期间的堆分配次数
+static std::atomic<bool> g_count_allocations{ false };
+static std::atomic<size_t> g_allocation_count{ 0 };
+
+void* operator new(std::size_t size) {
+    if (g_count_allocations) { ++g_allocation_count; }
+    if (void* p = std::malloc(size ? size : 1)) { return p; }
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+// 记录查询缓冲区的峰值字节数, 通过 withArena(&resource) 挂到查询上
+struct PeakResource : std::pmr::memory_resource {
+    size_t current = 0;
+    size_t peak = 0;
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        current += bytes;
+        peak = (std::max)(peak, current);
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+        current -= bytes;
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+};
 
 // 定义测试用的数据结构
 struct Player {
@@ -18,6 +60,22 @@ struct Player {
     }
 };
 
+// 让 Player 可以在 withMemoryLimit 模式下溢出到临时文件
+namespace dmlinq {
+    template <>
+    struct SpillCodec<Player> {
+        static size_t bytes(const Player& p) { return SpillCodec<std::string>::bytes(p.name) + SpillCodec<std::string>::bytes(p.team) + sizeof(p.score); }
+        static void write(std::FILE* file, const Player& p) {
+            SpillCodec<std::string>::write(file, p.name);
+            SpillCodec<std::string>::write(file, p.team);
+            SpillCodec<int>::write(file, p.score);
+        }
+        static bool read(std::FILE* file, Player& p) {
+            return SpillCodec<std::string>::read(file, p.name) && SpillCodec<std::string>::read(file, p.team) && SpillCodec<int>::read(file, p.score);
+        }
+    };
+}
+
 // 测试环境类
 class env_dmlinq
 {
@@ -269,4 +327,1209 @@ TEST_F(frame_dmlinq, Combined_ComplexQuery)
     EXPECT_TRUE(name_set.count("David"));
     EXPECT_TRUE(name_set.count("Eve"));
     EXPECT_TRUE(name_set.count("Frank"));
-}
\ No newline at end of file
+}
+
+TEST_F(frame_dmlinq, Sorting_ExternalSortWithMemoryLimit)
+{
+    using namespace dmlinq;
+    std::vector<int> values;
+    unsigned int seed = 12345;
+    for (int i = 0; i < 5000; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        values.push_back(static_cast<int>((seed >> 16) % 1000));
+    }
+
+    auto in_memory = from(values)
+        .where([](const int& n) { return n % 3 != 0; })
+        .orderBy([](const int& n) { return n; })
+        .skip(10).take(2000)
+        .toVector();
+    auto spilled = from(values)
+        .where([](const int& n) { return n % 3 != 0; })
+        .orderBy([](const int& n) { return n; })
+        .skip(10).take(2000)
+        .withMemoryLimit(64 * sizeof(int))
+        .toVector();
+    ASSERT_EQ(spilled.size(), 2000);
+    EXPECT_EQ(spilled, in_memory);
+
+    // Budget larger than the input: sorted in memory without spilling.
+    auto unspilled = from(numbers).orderBy([](const int& n) { return n; }).withMemoryLimit(1 << 20).toVector();
+    EXPECT_EQ(unspilled, (std::vector<int>{-2, 1, 1, 3, 4, 5}));
+
+    // Stability across runs: equal keys keep their original relative order.
+    auto by_score = from(players)
+        .orderByDescending([](const Player& p) { return p.score; })
+        .withMemoryLimit(1)
+        .select([](const Player& p) { return p.name; })
+        .toVector();
+    EXPECT_EQ(by_score, (std::vector<std::string>{"David", "Bob", "Eve", "Frank", "Alice", "Carol"}));
+
+    // 溢出排序边扫描边切分: 峰值内存只是预算的常数倍, 而不是整个输入
+    const size_t budget = 64 * 1024;
+    const int total = 500000; // 约 2 MB 的输入
+    auto pseudo_random = [](int i) { return static_cast<int>((static_cast<unsigned int>(i) * 2654435761u) >> 8); };
+    std::vector<int> large(total);
+    for (int i = 0; i < total; ++i) { large[i] = pseudo_random(i); }
+    std::vector<int> smallest = large;
+    std::partial_sort(smallest.begin(), smallest.begin() + 10, smallest.end());
+    smallest.resize(10);
+    auto ascending = [](const int& n) { return n; };
+
+    PeakResource generated_peak;
+    auto generated = fromGenerator([&pseudo_random, i = 0, total]() mutable { return i < total ? std::optional<int>(pseudo_random(i++)) : std::nullopt; })
+        .orderBy(ascending).take(10).withMemoryLimit(budget).withArena(&generated_peak)
+        .toVector();
+    EXPECT_EQ(generated, smallest);
+    EXPECT_LT(generated_peak.peak, 4 * budget);
+
+    PeakResource vector_peak;
+    auto from_vector = from(large).orderBy(ascending).take(10).withMemoryLimit(budget).withArena(&vector_peak).toVector();
+    EXPECT_EQ(from_vector, smallest);
+    EXPECT_LT(vector_peak.peak, 4 * budget);
+}
+
+TEST_F(frame_dmlinq, Grouping_GroupByAggregateByJoin)
+{
+    using namespace dmlinq;
+    auto teams = from(players)
+        .groupBy([](const Player& p) { return p.team; })
+        .toVector();
+    ASSERT_EQ(teams.size(), 2);
+    EXPECT_EQ(teams[0].first, "Eagles");
+    ASSERT_EQ(teams[0].second.size(), 3);
+    EXPECT_EQ(teams[0].second[2].name, "Carol");
+    EXPECT_EQ(teams[1].first, "Bears");
+
+    auto team_totals = from(players)
+        .aggregateBy([](const Player& p) { return p.team; }, 0, [](int acc, const Player& p) { return acc + p.score; })
+        .toMap([](const auto& entry) { return entry.first; }, [](const auto& entry) { return entry.second; });
+    EXPECT_EQ(team_totals.at("Eagles"), 180);
+    EXPECT_EQ(team_totals.at("Bears"), 245);
+
+    // High key cardinality with a tiny budget forces grace-hash partitioning to temp files.
+    std::vector<int> values;
+    for (int i = 0; i < 20000; ++i) { values.push_back((i * 7919) % 5003); }
+    std::map<int, int> expected_counts;
+    for (int v : values) { ++expected_counts[v]; }
+    auto spilled_counts = from(values)
+        .withMemoryLimit(4096)
+        .aggregateBy([](const int& n) { return n; }, 0, [](int acc, const int&) { return acc + 1; })
+        .toMap([](const auto& entry) { return entry.first; }, [](const auto& entry) { return entry.second; });
+    EXPECT_EQ(spilled_counts, expected_counts);
+
+    auto spilled_groups = from(players)
+        .withMemoryLimit(64)
+        .groupBy([](const Player& p) { return p.team; })
+        .orderBy([](const auto& group) { return group.first; })
+        .toVector();
+    ASSERT_EQ(spilled_groups.size(), 2);
+    EXPECT_EQ(spilled_groups[0].first, "Bears");
+    ASSERT_EQ(spilled_groups[0].second.size(), 3);
+    EXPECT_EQ(spilled_groups[0].second[0].name, "David");
+    EXPECT_EQ(spilled_groups[0].second[2].name, "Frank");
+
+    // Join
+    std::vector<std::pair<std::string, std::string>> cities = { {"Eagles", "Philadelphia"}, {"Bears", "Chicago"}, {"Lions", "Detroit"} };
+    auto join_query = [&](bool limited) {
+        auto outer = from(players);
+        if (limited) { outer = outer.withMemoryLimit(1); }
+        return outer
+            .join(from(cities), [](const Player& p) { return p.team; }, [](const auto& c) { return c.first; },
+                [](const Player& p, const auto& c) { return p.name + "@" + c.second; })
+            .toSet();
+    };
+    auto joined = join_query(false);
+    ASSERT_EQ(joined.size(), 6);
+    EXPECT_TRUE(joined.count("David@Chicago"));
+    EXPECT_TRUE(joined.count("Alice@Philadelphia"));
+    EXPECT_EQ(join_query(true), joined);
+
+    // 两侧键类型不同（string 与 const char*）时按外侧键类型分区，溢出后仍能全部匹配
+    std::vector<std::pair<const char*, int>> codes = { {"Eagles", 1}, {"Bears", 2} };
+    auto team_key = [](const Player& p) { return p.team; };
+    auto code_key = [](const std::pair<const char*, int>& c) { return c.first; };
+    auto tag = [](const Player& p, const std::pair<const char*, int>& c) { return p.name + std::to_string(c.second); };
+    auto spilled_join = from(players).withMemoryLimit(1).join(from(codes), team_key, code_key, tag).toSet();
+    EXPECT_EQ(spilled_join, from(players).join(from(codes), team_key, code_key, tag).toSet());
+    EXPECT_EQ(spilled_join.size(), 6u);
+
+    // 大输入、少量键: 聚合与连接都从游标流式读取, 峰值内存与输入大小无关
+    const int total = 500000;
+    auto counter = [total]() { return fromGenerator([i = 0, total]() mutable { return i < total ? std::optional<int>(i++) : std::nullopt; }); };
+    PeakResource aggregate_peak;
+    auto buckets = counter()
+        .withMemoryLimit(4096)
+        .withArena(&aggregate_peak)
+        .aggregateBy([](const int& n) { return n % 8; }, 0, [](int acc, const int&) { return acc + 1; })
+        .toVector();
+    ASSERT_EQ(buckets.size(), 8u);
+    for (const auto& bucket : buckets) { EXPECT_EQ(bucket.second, total / 8); }
+    EXPECT_LT(aggregate_peak.peak, 64 * 1024u);
+
+    std::vector<int> wanted = { 3, 1000, 499999 };
+    PeakResource join_peak;
+    auto identity = [](const int& n) { return n; };
+    auto pick = [](const int& n, const int&) { return n; };
+    auto matched = counter().withMemoryLimit(4096).withArena(&join_peak).join(from(wanted), identity, identity, pick).toVector();
+    EXPECT_EQ(matched, wanted);
+    EXPECT_LT(join_peak.peak, 64 * 1024u);
+}
+
+TEST_F(frame_dmlinq, Memory_QueryArena)
+{
+    using namespace dmlinq;
+    std::vector<int> values;
+    for (int i = 0; i < 1000; ++i) { values.push_back((i * 37) % 101); }
+    auto expected = from(values).where([](const int& n) { return n % 2 == 0; }).orderByDescending([](const int& n) { return n; }).toVector();
+
+    QueryArena arena;
+    // With the arena attached nothing in the pipeline may fall back to the default resource.
+    auto previous = std::pmr::set_default_resource(std::pmr::null_memory_resource());
+    auto sorted = from(values)
+        .withArena(arena)
+        .where([](const int& n) { return n % 2 == 0; })
+        .orderByDescending([](const int& n) { return n; })
+        .toVector();
+    auto names = from(players)
+        .withArena(arena)
+        .orderBy([](const Player& p) { return p.score; })
+        .select([](const Player& p) { return p.name; })
+        .toVector();
+    auto teams = from(players)
+        .withArena(arena)
+        .groupBy([](const Player& p) { return p.team; })
+        .count();
+    std::pmr::set_default_resource(previous);
+    // The queries above were temporaries, so none outlives release(); the results live on the heap.
+    arena.release();
+
+    EXPECT_EQ(sorted, expected);
+    EXPECT_EQ(names, (std::vector<std::string>{"Alice", "Carol", "Frank", "Bob", "Eve", "David"}));
+    EXPECT_EQ(teams, 2);
+}
+
+TEST_F(frame_dmlinq, Callables_InlineStorageNoHeap)
+{
+    using namespace dmlinq;
+    std::string excluded = "Zed";
+    auto query = from(players);
+
+    g_allocation_count = 0;
+    g_count_allocations = true;
+    auto built = std::move(query)
+        .where([](const Player& p) { return p.score >= 50; })
+        .where([](const Player& p) { return !p.name.empty(); })
+        .where([excluded](const Player& p) { return p.name != excluded; })
+        .where([](const Player& p) { return p.team != "Lions"; })
+        .where([](const Player& p) { return p.score <= 100; })
+        .orderBy([](const Player& p) { return p.team; })
+        .thenByDescending([](const Player& p) { return p.score; })
+        .thenBy([](const Player& p) { return p.name; });
+    g_count_allocations = false;
+    EXPECT_EQ(g_allocation_count, 0u);
+
+    auto names = built.select([](const Player& p) { return p.name; }).toVector();
+    EXPECT_EQ(names, (std::vector<std::string>{"David", "Eve", "Frank", "Bob", "Alice", "Carol"}));
+
+    // Oversized captures still work; they just fall back to the heap.
+    std::array<int, 64> big{};
+    big[0] = 3;
+    InlineFunction<bool(const int&)> fits([](const int& n) { return n > 0; });
+    InlineFunction<bool(const int&)> spills([big](const int& n) { return n == big[0]; });
+    InlineFunction<bool(const int&)> copied = spills;
+    EXPECT_TRUE(fits(1));
+    EXPECT_TRUE(copied(3));
+    EXPECT_FALSE(InlineFunction<bool(const int&)>::storedInline<decltype(big)>());
+    EXPECT_EQ(from(numbers).where(copied).count(), 1);
+}
+
+TEST_F(frame_dmlinq, Compiled_ParameterizedPlan)
+{
+    using namespace dmlinq;
+    auto plan = compile<Player>();
+    auto min_score = plan.param<int>("min_score");
+    auto team = plan.param<std::string>("team");
+    auto limit = plan.param<size_t>("limit");
+    plan.where([min_score](const Player& p, const QueryArgs& args) { return p.score >= args.get(min_score); })
+        .where([team](const Player& p, const QueryArgs& args) { return p.team == args.get(team); })
+        .orderByDescending([](const Player& p) { return p.score; })
+        .take(limit);
+
+    auto bears = plan.execute(players, plan.bind().set(min_score, 80).set(team, std::string("Bears")).set(limit, size_t{ 10 }));
+    ASSERT_EQ(bears.size(), 2);
+    EXPECT_EQ(bears[0].name, "David");
+    EXPECT_EQ(bears[1].name, "Eve");
+
+    auto args = plan.bind();
+    args.set("min_score", 0).set("team", std::string("Eagles")).set("limit", size_t{ 2 });
+    auto eagles = plan.execute(players, args);
+    ASSERT_EQ(eagles.size(), 2);
+    EXPECT_EQ(eagles[0].name, "Bob");
+    EXPECT_EQ(plan.count(players, args), 2);
+    EXPECT_THROW(args.set("missing", 1), std::runtime_error);
+    // 按名字设置时类型必须与声明一致, 当场报错而不是等到 execute
+    EXPECT_THROW(args.set("limit", 10), std::runtime_error);
+    EXPECT_THROW(args.set("team", "Eagles"), std::runtime_error);
+
+    // 排序后 take 远小于输入时走 top-k, 结果与普通查询一致 (并列时保持原顺序)
+    std::vector<int> values(1000);
+    for (int i = 0; i < 1000; ++i) { values[i] = (i * 37) % 101; }
+    auto by_bucket = [](const int& n) { return n % 10; };
+    auto top_plan = compile<int>();
+    auto top_count = top_plan.param<size_t>("count");
+    top_plan.orderBy(by_bucket).skip(3).take(top_count);
+    auto top = top_plan.execute(values, top_plan.bind().set(top_count, size_t{ 5 }));
+    EXPECT_EQ(top, from(values).orderBy(by_bucket).skip(3).take(5).toVector());
+    auto everything = top_plan.execute(values, top_plan.bind().set(top_count, (std::numeric_limits<size_t>::max)()));
+    EXPECT_EQ(everything.size(), 997u);
+    EXPECT_THROW(plan.execute(players, plan.bind()), std::runtime_error);
+
+    // One plan, many threads, different arguments.
+    std::vector<std::thread> workers;
+    std::atomic<int> mismatches{ 0 };
+    for (int t = 0; t < 4; ++t) {
+        workers.emplace_back([&, t]() {
+            int threshold = t * 20 + 40;
+            auto expected = from(players).where([threshold](const Player& p) { return p.score >= threshold && p.team == "Bears"; }).count();
+            auto thread_args = plan.bind().set(min_score, threshold).set(team, std::string("Bears")).set(limit, size_t{ 100 });
+            for (int i = 0; i < 200; ++i) {
+                if (plan.execute(players, thread_args).size() != expected) { ++mismatches; }
+            }
+        });
+    }
+    for (auto& worker : workers) { worker.join(); }
+    EXPECT_EQ(mismatches, 0);
+}
+
+TEST_F(frame_dmlinq, Explain_PlanTree)
+{
+    using namespace dmlinq;
+    std::vector<int> values(1000);
+    std::iota(values.begin(), values.end(), 0);
+
+    auto top_query = from(values)
+        .where([](const int& n) { return n % 2 == 0; })
+        .orderByDescending([](const int& n) { return n; })
+        .take(10);
+    auto plan = top_query.explain();
+    EXPECT_EQ(plan.op, "Take");
+    ASSERT_EQ(plan.children.size(), 1);
+    const auto& sort = plan.children[0];
+    EXPECT_EQ(sort.op, "Sort");
+    EXPECT_EQ(sort.algorithm, "top-k partial sort, k=10");
+    EXPECT_TRUE(sort.materializes);
+    EXPECT_EQ(sort.children[0].op, "Filter");
+    EXPECT_EQ(sort.children[0].estimated_rows, 333);
+    EXPECT_EQ(sort.children[0].children[0].estimated_rows, 1000);
+
+    // The top-k path must produce exactly what a full stable sort would.
+    auto top = top_query.toVector();
+    ASSERT_EQ(top.size(), 10);
+    EXPECT_EQ(top.front(), 998);
+    EXPECT_EQ(top.back(), 980);
+    std::vector<std::pair<int, int>> keyed;
+    for (int i = 0; i < 100; ++i) { keyed.emplace_back(i % 5, i); }
+    auto stable_top = from(keyed).orderBy([](const auto& kv) { return kv.first; }).take(3).toVector();
+    EXPECT_EQ(stable_top, (std::vector<std::pair<int, int>>{ {0, 0}, {0, 5}, {0, 10} }));
+
+    auto full_sort = from(values).orderBy([](const int& n) { return -n; }).explain();
+    EXPECT_EQ(full_sort.algorithm, "std::stable_sort");
+    EXPECT_FALSE(full_sort.children[0].materializes); // 源数据经游标原地读取
+    QueryArena plan_arena;
+    auto arena_sort = from(values).orderBy([](const int& n) { return -n; }).withArena(plan_arena).explain();
+    EXPECT_EQ(arena_sort.algorithm, "stable merge sort (query resource)");
+    auto generated = fromGenerator([n = 0]() mutable { return n < 100 ? std::optional<int>(n++) : std::nullopt; });
+    auto unknown_top = generated.orderBy([](const int& n) { return n; }).take(5).explain();
+    EXPECT_EQ(unknown_top.children[0].algorithm, "top-k partial sort, k=5 if input > 20 rows, else std::stable_sort");
+
+    auto projected = from(players)
+        .groupBy([](const Player& p) { return p.team; })
+        .select([](const auto& group) { return group.first; })
+        .explain();
+    EXPECT_EQ(projected.op, "Select");
+    EXPECT_FALSE(projected.materializes);
+    EXPECT_TRUE(projected.children[0].materializes);
+    EXPECT_EQ(projected.children[0].op, "GroupBy");
+    EXPECT_EQ(projected.children[0].algorithm, "hash");
+
+    std::string text = fmt::format("{}", top_query.explain());
+    EXPECT_EQ(text,
+        "Take: 10 (rows~10)\n"
+        "  Sort: top-k partial sort, k=10 (rows~333) [materialize]\n"
+        "    Filter: 1 predicate(s) (rows~333)\n"
+        "      Source: std::vector (rows~1000)\n");
+}
+
+TEST_F(frame_dmlinq, Profiling_OperatorReport)
+{
+    using namespace dmlinq;
+    ASSERT_TRUE(QueryProfile::enabled());
+
+    std::vector<int> values;
+    for (int i = 0; i < 1000; ++i) { values.push_back((i * 37) % 1000); }
+
+    // 每个算子记录一行：输入/输出行数、耗时与分配
+    QueryProfile profile;
+    auto result = from(values)
+        .where([](const int& n) { return n % 2 == 0; })
+        .orderBy([](const int& n) { return n; })
+        .skip(10)
+        .take(5)
+        .withProfiling(profile)
+        .toVector();
+    EXPECT_EQ(result, (std::vector<int>{ 20, 22, 24, 26, 28 }));
+
+    const auto& ops = profile.operators();
+    ASSERT_EQ(ops.size(), 5u);
+    EXPECT_EQ(ops[0].op, "Source");
+    EXPECT_EQ(ops[0].rows_out, 1000u);
+    EXPECT_GE(ops[0].allocations, 1u);
+    EXPECT_GE(ops[0].bytes_allocated, 1000 * sizeof(int));
+    EXPECT_EQ(ops[1].op, "Filter");
+    EXPECT_EQ(ops[1].rows_in, 1000u);
+    EXPECT_EQ(ops[1].rows_out, 500u);
+    EXPECT_EQ(ops[2].op, "TopK");
+    EXPECT_EQ(ops[3].op, "Skip");
+    EXPECT_EQ(ops[3].rows_out, 5u);
+    EXPECT_EQ(ops[4].op, "Take");
+    EXPECT_EQ(ops[4].rows_out, 5u);
+
+    // 跨越 select/groupBy 的阶段同样被记录
+    profile.clear();
+    auto teams = from(players)
+        .groupBy([](const Player& p) { return p.team; })
+        .select([](const auto& group) { return group.second.size(); })
+        .withProfiling(profile)
+        .toVector();
+    EXPECT_EQ(teams.size(), 2u);
+    // groupBy 通过游标读取来源, 不再先物化一个 Source 缓冲区
+    ASSERT_EQ(profile.operators().size(), 2u);
+    EXPECT_EQ(profile.operators()[0].op, "GroupBy");
+    EXPECT_EQ(profile.operators()[0].rows_out, 2u);
+    EXPECT_EQ(profile.operators()[1].op, "Select");
+
+    auto report = toString(profile);
+    EXPECT_NE(report.find("GroupBy"), std::string::npos);
+}
+
+TEST_F(frame_dmlinq, Instrument_CopyCounting)
+{
+    using namespace dmlinq;
+    using Item = instrument::Counted<int>;
+
+    // 右值来源直接被移动，整条查询零拷贝
+    std::vector<Item> items;
+    for (int i = 0; i < 100; ++i) { items.emplace_back(99 - i); }
+    {
+        instrument::Scope scope;
+        auto result = from(std::move(items)).toVector();
+        EXPECT_EQ(result.size(), 100u);
+        EXPECT_EQ(scope.counts().copies, 0u);
+        EXPECT_GE(scope.counts().allocations, 1u);
+    }
+
+    // 左值来源只在 from() 拷贝一次，物化执行时再拷贝一次
+    std::vector<Item> source;
+    for (int i = 0; i < 100; ++i) { source.emplace_back(99 - i); }
+    {
+        instrument::Scope scope;
+        auto query = from(source);
+        EXPECT_EQ(scope.counts().copies, 100u);
+        auto projected = query.select([](const Item& v) { return v.get() * 2; });
+        EXPECT_EQ(scope.counts().copies, 100u); // 复制查询阶段不复制数据
+        EXPECT_EQ(projected.count(), 100u);
+        EXPECT_EQ(scope.counts().copies, 100u); // count() 直接从来源流式读取
+        EXPECT_EQ(projected.toVector().size(), 100u);
+        EXPECT_EQ(scope.counts().copies, 200u);
+    }
+
+    // 排序时比较次数可以断言
+    {
+        instrument::Scope scope;
+        auto sorted = from(source).orderBy([](const Item& v) { return v; }).toVector();
+        EXPECT_EQ(sorted.front().get(), 0);
+        auto comparisons = scope.counts().comparisons;
+        EXPECT_GT(comparisons, 0u);
+        EXPECT_LE(comparisons, 100u * 7u * 2u);
+    }
+}
+
+TEST_F(frame_dmlinq, Streaming_PartitionOperators)
+{
+    using namespace dmlinq;
+
+    // 有序日志：skipWhile/takeWhile 只扫描到窗口末尾
+    std::vector<int> timestamps;
+    for (int i = 0; i < 10000; ++i) { timestamps.push_back(i * 10); }
+    size_t inspected = 0;
+    auto window_rows = from(timestamps)
+        .where([&inspected](const int& ts) { ++inspected; return ts % 20 == 0; })
+        .skipWhile([](const int& ts) { return ts < 1000; })
+        .takeWhile([](const int& ts) { return ts < 1100; })
+        .toVector();
+    EXPECT_EQ(window_rows, (std::vector<int>{ 1000, 1020, 1040, 1060, 1080 }));
+    EXPECT_EQ(inspected, 111u); // 0..1100，之后的数据不再读取
+
+    // 未排序的 take 同样提前结束
+    inspected = 0;
+    auto page = from(timestamps)
+        .where([&inspected](const int& ts) { ++inspected; return ts % 30 == 0; })
+        .skip(2)
+        .take(3)
+        .toVector();
+    EXPECT_EQ(page, (std::vector<int>{ 60, 90, 120 }));
+    EXPECT_EQ(inspected, 13u);
+
+    // chunk：最后一批可以不满
+    auto chunks = from(numbers).chunk(4).toVector();
+    ASSERT_EQ(chunks.size(), 2u);
+    EXPECT_EQ(chunks[0], (std::vector<int>{ 5, 1, 4, 1 }));
+    EXPECT_EQ(chunks[1], (std::vector<int>{ 3, -2 }));
+    EXPECT_THROW((void)from(numbers).chunk(0), std::runtime_error);
+
+    // 最后一批不满时已经读到结尾, 之后不再拉取生成器
+    int pulls_after_end = 0;
+    auto ten = [&pulls_after_end, n = 0]() mutable -> std::optional<int> {
+        if (n == 10) { ++pulls_after_end; return std::nullopt; }
+        return n++;
+    };
+    auto ten_chunks = fromGenerator(ten).chunk(4).toVector();
+    ASSERT_EQ(ten_chunks.size(), 3u);
+    EXPECT_EQ(ten_chunks[2], (std::vector<int>{ 8, 9 }));
+    EXPECT_EQ(pulls_after_end, 1);
+
+    // window：只输出完整窗口，step 控制滑动距离
+    auto windows = from(numbers).window(3).select([](const std::vector<int>& w) { return w[0] + w[1] + w[2]; }).toVector();
+    EXPECT_EQ(windows, (std::vector<int>{ 10, 6, 8, 2 }));
+    auto hopping = from(numbers).window(2, 3).toVector();
+    EXPECT_EQ(hopping, (std::vector<std::vector<int>>{ { 5, 1 }, { 1, 3 } }));
+
+    // 排序后的流式算子在物化结果上工作
+    auto sorted_prefix = from(numbers).orderBy([](const int& n) { return n; }).takeWhile([](const int& n) { return n < 4; }).toVector();
+    EXPECT_EQ(sorted_prefix, (std::vector<int>{ -2, 1, 1, 3 }));
+
+    auto plan = from(timestamps).takeWhile([](const int& ts) { return ts < 100; }).explain();
+    EXPECT_EQ(plan.op, "TakeWhile");
+    EXPECT_EQ(plan.children[0].op, "Source");
+}
+
+TEST_F(frame_dmlinq, Streaming_RollingAggregates)
+{
+    using namespace dmlinq;
+
+    // numbers = {5, 1, 4, 1, 3, -2}，窗口大小 3
+    EXPECT_EQ(from(numbers).rollingSum(3).toVector(), (std::vector<int>{ 10, 6, 8, 2 }));
+    EXPECT_EQ(from(numbers).rollingMin(3).toVector(), (std::vector<int>{ 1, 1, 1, -2 }));
+    EXPECT_EQ(from(numbers).rollingMax(3).toVector(), (std::vector<int>{ 5, 4, 4, 3 }));
+    auto averages = from(numbers).rollingAvg(2).toVector();
+    EXPECT_EQ(averages, (std::vector<double>{ 3.0, 2.5, 2.5, 2.0, 0.5 }));
+
+    // 按字段聚合
+    auto score_sums = from(players).rollingSum(2, [](const Player& p) { return p.score; }).toVector();
+    EXPECT_EQ(score_sums, (std::vector<int>{ 140, 170, 160, 155, 125 }));
+
+    // 通用可逆折叠：窗口内的乘积
+    auto products = from(std::vector<double>{ 1, 2, 4, 8 })
+        .rollingFold(2, 1.0, [](double acc, const double& v) { return acc * v; }, [](double acc, const double& v) { return acc / v; })
+        .toVector();
+    EXPECT_EQ(products, (std::vector<double>{ 2, 8, 32 }));
+
+    // 与暴力 O(n*w) 计算对比
+    std::vector<int> series;
+    for (int i = 0; i < 500; ++i) { series.push_back((i * 7919) % 101 - 50); }
+    auto rolling_min = from(series).rollingMin(17).toVector();
+    auto rolling_sum = from(series).rollingSum(17).toVector();
+    ASSERT_EQ(rolling_min.size(), series.size() - 16);
+    for (size_t i = 0; i < rolling_min.size(); ++i) {
+        EXPECT_EQ(rolling_min[i], *std::min_element(series.begin() + i, series.begin() + i + 17));
+        EXPECT_EQ(rolling_sum[i], std::accumulate(series.begin() + i, series.begin() + i + 17, 0));
+    }
+
+    // 窗口大于输入时没有输出；窗口为 0 报错
+    EXPECT_TRUE(from(numbers).rollingMax(10).toVector().empty());
+    EXPECT_THROW((void)from(numbers).rollingMin(0), std::runtime_error);
+}
+
+TEST_F(frame_dmlinq, Streaming_ZipConcatMerge)
+{
+    using namespace dmlinq;
+
+    std::vector<std::string> names = { "a", "b", "c" };
+    auto labelled = from(numbers).zip(from(names), [](const int& n, const std::string& s) { return s + std::to_string(n); }).toVector();
+    EXPECT_EQ(labelled, (std::vector<std::string>{ "a5", "b1", "c4" }));
+
+    auto joined = from(numbers).where([](const int& n) { return n > 2; }).concat(from(std::vector<int>{ 7, 8 })).toVector();
+    EXPECT_EQ(joined, (std::vector<int>{ 5, 4, 3, 7, 8 }));
+
+    // 两个有序输入归并，键相同时左侧优先
+    std::vector<std::pair<int, char>> left = { {1, 'L'}, {3, 'L'}, {5, 'L'} };
+    std::vector<std::pair<int, char>> right = { {2, 'R'}, {3, 'R'}, {6, 'R'} };
+    auto merged = from(left).mergeSorted(from(right), [](const auto& p) { return p.first; }).toVector();
+    EXPECT_EQ(merged, (std::vector<std::pair<int, char>>{ {1, 'L'}, {2, 'R'}, {3, 'L'}, {3, 'R'}, {5, 'L'}, {6, 'R'} }));
+
+    // 聚合直接从两侧拉取，不分配合并后的缓冲区
+    std::vector<int> big_a(100000, 1);
+    std::vector<int> big_b(100000, 2);
+    auto query_a = from(big_a);
+    auto query_b = from(big_b);
+    {
+        instrument::Scope scope;
+        EXPECT_EQ(query_a.concat(query_b).sum(), 300000);
+        auto product = [](const int& x, const int& y) { return x * y; };
+        EXPECT_EQ(query_a.zip(query_b, product).count(), 100000u);
+        EXPECT_EQ(scope.counts().bytes_allocated, 0u);
+    }
+
+    auto plan = from(left).mergeSorted(from(right), [](const auto& p) { return p.first; }).explain();
+    EXPECT_EQ(plan.op, "MergeSorted");
+    ASSERT_EQ(plan.children.size(), 2u);
+    EXPECT_EQ(plan.estimated_rows, std::optional<size_t>(6));
+}
+
+TEST_F(frame_dmlinq, Sources_GeneratorsAndAsync)
+{
+    using namespace dmlinq;
+
+    // 拉取式生成器：take 满足后不再拉取
+    int produced = 0;
+    auto squares = fromGenerator([&produced]() -> std::optional<int> {
+        if (produced == 1000) return std::nullopt;
+        ++produced;
+        return produced * produced;
+        })
+        .where([](const int& n) { return n % 2 == 1; })
+        .take(3)
+        .toVector();
+    EXPECT_EQ(squares, (std::vector<int>{ 1, 9, 25 }));
+    EXPECT_EQ(produced, 5);
+
+    // 分页来源：只请求需要的页
+    int pages_fetched = 0;
+    auto fetch_page = [&pages_fetched]() {
+        std::vector<int> page;
+        if (pages_fetched < 10) {
+            for (int i = 0; i < 4; ++i) { page.push_back(pages_fetched * 4 + i); }
+        }
+        ++pages_fetched;
+        return page;
+    };
+    auto first_rows = fromPages(fetch_page).takeWhile([](const int& n) { return n < 6; }).toVector();
+    EXPECT_EQ(first_rows, (std::vector<int>{ 0, 1, 2, 3, 4, 5 }));
+    EXPECT_EQ(pages_fetched, 2);
+    pages_fetched = 0;
+    EXPECT_EQ(fromPages(fetch_page).sum(), 780);
+    EXPECT_EQ(pages_fetched, 11);
+
+    // 异步终端：事件循环按批次推进
+    std::deque<std::function<void()>> loop;
+    auto post = [&loop](std::function<void()> task) { loop.push_back(std::move(task)); };
+    std::vector<int> collected;
+    std::vector<int> source(2500);
+    std::iota(source.begin(), source.end(), 0);
+    from(source).where([](const int& n) { return n % 5 == 0; }).toVectorAsync(100).drive(post, [&collected](std::vector<int> rows) { collected = std::move(rows); });
+    size_t turns = 0;
+    while (!loop.empty()) {
+        auto task = std::move(loop.front());
+        loop.pop_front();
+        task();
+        ++turns;
+    }
+    EXPECT_EQ(collected.size(), 500u);
+    EXPECT_EQ(collected.back(), 2495);
+    EXPECT_EQ(turns, 6u); // 5 批数据 + 1 次结束
+
+    // 手动单步
+    long long total = 0;
+    auto each = from(numbers).forEachAsync([&total](const int& n) { total += n; }, 2);
+    EXPECT_FALSE(each.step());
+    EXPECT_EQ(total, 6);
+    EXPECT_THROW(each.get(), std::runtime_error);
+    while (!each.step()) {}
+    EXPECT_EQ(each.get(), 6u);
+    EXPECT_EQ(total, 12);
+    EXPECT_THROW(each.get(), std::runtime_error); // 结果只能取走一次
+}
+
+TEST_F(frame_dmlinq, Push_IncrementalQuery)
+{
+    using namespace dmlinq;
+
+    // 查询只建立一次，事件逐条推入
+    PushSource<Player> events;
+    auto eagles = events.where([](const Player& p) { return p.team == "Eagles"; });
+    std::vector<std::string> seen;
+    eagles.select([](const Player& p) { return p.name; }).subscribe([&seen](const std::string& name) { seen.push_back(name); });
+    auto eagle_count = eagles.count();
+    auto eagle_total = eagles.sum([](const Player& p) { return p.score; });
+    auto best = events.max([](const Player& p) { return p.score; });
+    auto average = events.average([](const Player& p) { return p.score; });
+    auto per_team = events.aggregateBy([](const Player& p) { return p.team; }, 0, [](int acc, const Player& p) { return acc + p.score; });
+    std::vector<std::string> first_two;
+    events.take(2).subscribe([&first_two](const Player& p) { first_two.push_back(p.name); });
+
+    EXPECT_FALSE(best.value().has_value());
+    events.push(players[0]);
+    EXPECT_EQ(eagle_count.value(), 1u);
+    EXPECT_EQ(eagle_total.value(), 50);
+    EXPECT_EQ(best.value(), std::optional<int>(50));
+
+    // 批量推入剩余事件
+    events.pushBatch(std::vector<Player>(players.begin() + 1, players.end()));
+    EXPECT_EQ(seen, (std::vector<std::string>{ "Alice", "Bob", "Carol" }));
+    EXPECT_EQ(eagle_count.value(), 3u);
+    EXPECT_EQ(eagle_total.value(), 180);
+    EXPECT_EQ(best.value(), std::optional<int>(90));
+    EXPECT_DOUBLE_EQ(average.value(), 425.0 / 6.0);
+    EXPECT_EQ(per_team.value().at("Bears"), 245);
+    EXPECT_EQ(per_team.value().at("Eagles"), 180);
+    EXPECT_EQ(first_two, (std::vector<std::string>{ "Alice", "David" }));
+
+    // 与每次全量执行的结果一致
+    EXPECT_EQ(eagle_total.value(), from(players).where([](const Player& p) { return p.team == "Eagles"; }).sum([](const Player& p) { return p.score; }));
+}
+
+TEST_F(frame_dmlinq, Views_IncrementalMaintenance)
+{
+    using namespace dmlinq;
+
+    auto high_scores = from(players).where([](const Player& p) { return p.score >= 60; });
+    auto view = high_scores.materialize([](const Player& p) { return p.score; });
+    EXPECT_EQ(view.count(), 4u);
+    EXPECT_EQ(view.sum(), 325);
+    EXPECT_EQ(view.min(), std::optional<int>(75));
+    EXPECT_EQ(view.max(), std::optional<int>(90));
+
+    // 增量：插入、删除、更新；不满足过滤条件的行被忽略
+    view.insert({ "Gina", "Eagles", 95 });
+    view.insert({ "Hank", "Bears", 10 });
+    EXPECT_EQ(view.count(), 5u);
+    EXPECT_EQ(view.max(), std::optional<int>(95));
+    view.erase({ "David", "Bears", 90 });
+    view.update({ "Frank", "Bears", 75 }, { "Frank", "Bears", 40 });
+    EXPECT_EQ(view.count(), 3u);
+    EXPECT_EQ(view.sum(), 255);
+    EXPECT_EQ(view.min(), std::optional<int>(80));
+    EXPECT_DOUBLE_EQ(view.average(), 85.0);
+    EXPECT_THROW(view.erase({ "Nobody", "Bears", 61 }), std::runtime_error);
+
+    // 分组视图：组在最后一行删除后消失
+    auto by_team = from(players).materializeBy([](const Player& p) { return p.team; }, [](const Player& p) { return p.score; });
+    ASSERT_NE(by_team.group("Bears"), nullptr);
+    EXPECT_EQ(by_team.group("Bears")->sum(), 245);
+    EXPECT_EQ(by_team.group("Eagles")->max(), std::optional<int>(80));
+    by_team.insert({ "Ivy", "Owls", 70 });
+    EXPECT_EQ(by_team.groups().size(), 3u);
+    by_team.erase({ "Ivy", "Owls", 70 });
+    EXPECT_EQ(by_team.group("Owls"), nullptr);
+    by_team.update({ "Bob", "Eagles", 80 }, { "Bob", "Bears", 80 });
+    EXPECT_EQ(by_team.group("Eagles")->count(), 2u);
+    EXPECT_EQ(by_team.group("Bears")->sum(), 325);
+    EXPECT_EQ(by_team.sum(), 425);
+
+    EXPECT_THROW((void)from(players).take(2).materialize([](const Player& p) { return p.score; }), std::runtime_error);
+
+    // 增量无法经过索引探测或上游算子，这类查询不能物化
+    auto score_of = [](const Player& p) { return p.score; };
+    auto renamed = [](const Player& p) { return Player{ p.name + "!", p.team, p.score }; };
+    IndexedVector<Player> table(players);
+    const auto& team_index = table.addHashIndex([](const Player& p) { return p.team; });
+    EXPECT_THROW((void)from(table).whereIndexed(team_index, "Bears").materialize(score_of), std::runtime_error);
+    EXPECT_THROW((void)from(players).select(renamed).where([](const Player& p) { return p.score > 60; }).materialize(score_of), std::runtime_error);
+}
+
+TEST_F(frame_dmlinq, Index_PointAndRangeProbes)
+{
+    using namespace dmlinq;
+
+    IndexedVector<Player> table(players);
+    const auto& by_team = table.addHashIndex([](const Player& p) { return p.team; });
+    const auto& by_score = table.addOrderedIndex([](const Player& p) { return p.score; });
+
+    // 等值探测只返回匹配行，保持原始顺序
+    size_t evaluated = 0;
+    auto bears = from(table)
+        .whereIndexed(by_team, "Bears")
+        .where([&evaluated](const Player&) { ++evaluated; return true; })
+        .select([](const Player& p) { return p.name; })
+        .toVector();
+    EXPECT_EQ(bears, (std::vector<std::string>{ "David", "Eve", "Frank" }));
+    EXPECT_EQ(evaluated, 3u);
+
+    // 范围探测（闭区间），多个探测取交集
+    auto mid = from(table).whereIndexed(by_score, 60, 85).select([](const Player& p) { return p.name; }).toVector();
+    EXPECT_EQ(mid, (std::vector<std::string>{ "Bob", "Eve", "Frank" }));
+    auto mid_eagles = from(table).whereIndexed(by_score, 60, 85).whereIndexed(by_team, "Eagles").toVector();
+    ASSERT_EQ(mid_eagles.size(), 1u);
+    EXPECT_EQ(mid_eagles[0].name, "Bob");
+    EXPECT_EQ(from(table).whereIndexed(by_team, "Owls").count(), 0u);
+
+    auto plan = from(table).whereIndexed(by_score, 50, 50).explain();
+    EXPECT_EQ(plan.estimated_rows, std::optional<size_t>(2));
+    EXPECT_NE(plan.algorithm.find("index probe"), std::string::npos);
+
+    // 与全表扫描结果一致
+    std::vector<int> values;
+    for (int i = 0; i < 5000; ++i) { values.push_back((i * 7919) % 1000); }
+    IndexedVector<int> numbers_table(values);
+    const auto& value_index = numbers_table.addOrderedIndex([](const int& v) { return v; });
+    auto probed = from(numbers_table).whereIndexed(value_index, 100, 120).orderBy([](const int& v) { return v; }).toVector();
+    auto scanned = from(values).where([](const int& v) { return v >= 100 && v <= 120; }).orderBy([](const int& v) { return v; }).toVector();
+    EXPECT_EQ(probed, scanned);
+
+    // 索引必须属于查询的来源
+    EXPECT_THROW((void)from(players).whereIndexed(by_team, "Bears"), std::runtime_error);
+}
+
+TEST_F(frame_dmlinq, Index_ZoneMapSkipsBlocks)
+{
+    using namespace dmlinq;
+
+    // 追加写入的日志：时间戳大致有序
+    struct LogLine { int64_t ts; int level; };
+    std::vector<LogLine> lines;
+    for (int i = 0; i < 100000; ++i) { lines.push_back({ i * 10 + (i % 7), i % 4 }); }
+    IndexedVector<LogLine> log(lines);
+    const auto& by_ts = log.addZoneMap([](const LogLine& l) { return l.ts; }, 1000);
+    EXPECT_EQ(by_ts.blockCount(), 100u);
+
+    size_t inspected = 0;
+    auto hits = from(log)
+        .whereBetween(by_ts, 500000, 520000)
+        .where([&inspected](const LogLine&) { ++inspected; return true; })
+        .count();
+    auto expected = from(lines).whereBetween([](const LogLine& l) { return l.ts; }, int64_t{ 500000 }, int64_t{ 520000 }).count();
+    EXPECT_EQ(hits, expected);
+    EXPECT_EQ(hits, 2000u);
+    EXPECT_EQ(inspected, hits);
+
+    // 只读取重叠的块
+    auto plan = from(log).whereBetween(by_ts, 500000, 520000).explain();
+    ASSERT_FALSE(plan.children.empty());
+    EXPECT_NE(plan.children[0].algorithm.find("zone map"), std::string::npos);
+    ASSERT_TRUE(plan.children[0].estimated_rows.has_value());
+    EXPECT_LE(*plan.children[0].estimated_rows, 4000u);
+
+    EXPECT_EQ(from(log).whereBetween(by_ts, -100, -1).count(), 0u);
+}
+
+TEST_F(frame_dmlinq, Join_SemiAntiBloom)
+{
+    using namespace dmlinq;
+
+    std::vector<int> orders;
+    for (int i = 0; i < 10000; ++i) { orders.push_back(i % 1000); }
+    std::vector<int> vip = { 3, 7, 7, 42, 5000 };
+
+    // 内表较小：用内表建 bloom filter + 哈希集合
+    auto by_vip = from(orders).whereIn(from(vip), [](int id) { return id; }).toVector();
+    EXPECT_EQ(by_vip.size(), 30u);
+    EXPECT_EQ(by_vip[0], 3);
+    EXPECT_EQ(by_vip[1], 7);
+    auto id_of = [](int id) { return id; };
+    EXPECT_EQ(from(orders).antiJoin(from(vip), id_of, id_of).count(), 9970u);
+
+    // 外表较小：用外表建表，保持外表顺序，每行最多输出一次
+    auto named = from(players).semiJoin(from(orders), [](const Player& p) { return static_cast<int>(p.name.size()); }, [](int id) { return id; }).toVector();
+    ASSERT_EQ(named.size(), 6u);
+    EXPECT_EQ(named[0].name, "Alice");
+    auto bears = from(players).antiJoin(from(players).where([](const Player& p) { return p.team == "Eagles"; }),
+        [](const Player& p) { return p.name; }, [](const Player& p) { return p.name; }).toVector();
+    ASSERT_EQ(bears.size(), 3u);
+    EXPECT_EQ(bears[0].name, "David");
+
+    // bloom filter 没有假阴性，假阳性率很低
+    detail::BlockedBloomFilter bloom(10000, std::pmr::get_default_resource());
+    for (int i = 0; i < 10000; ++i) { bloom.insert(detail::mixedHash(i)); }
+    size_t false_negatives = 0;
+    for (int i = 0; i < 10000; ++i) { if (!bloom.mayContain(detail::mixedHash(i))) ++false_negatives; }
+    size_t false_positives = 0;
+    for (int i = 10000; i < 110000; ++i) { if (bloom.mayContain(detail::mixedHash(i))) ++false_positives; }
+    EXPECT_EQ(false_negatives, 0u);
+    EXPECT_LT(false_positives, 1000u);
+
+    auto plan = from(orders).whereIn(from(vip), [](int id) { return id; }).explain();
+    EXPECT_EQ(plan.op, "SemiJoin");
+    EXPECT_EQ(plan.children.size(), 2u);
+}
+
+TEST_F(frame_dmlinq, Aggregation_CountDistinct)
+{
+    using namespace dmlinq;
+
+    EXPECT_EQ(from(numbers).countDistinct(), 5u);
+    auto team_of = [](const Player& p) { return p.team; };
+    EXPECT_EQ(from(players).countDistinct(team_of), 2u);
+    EXPECT_EQ(from(empty_numbers).countDistinct(), 0u);
+    EXPECT_EQ(from(empty_numbers).countDistinctApprox(), 0u);
+
+    std::vector<int64_t> ids;
+    for (int64_t i = 0; i < 200000; ++i) { ids.push_back((i * 7919) % 100000); }
+    EXPECT_EQ(from(ids).countDistinct(), 100000u);
+
+    // 默认精度 14，标准误差约 0.8%
+    auto approx = from(ids).countDistinctApprox();
+    EXPECT_NEAR(static_cast<double>(approx), 100000.0, 3000.0);
+    EXPECT_NEAR(static_cast<double>(from(numbers).countDistinctApprox()), 5.0, 0.5);
+
+    // 不相交分片的草图合并后等于整体的草图
+    auto low = from(ids).where([](int64_t id) { return id < 50000; }).toHyperLogLog();
+    auto high = from(ids).where([](int64_t id) { return id >= 50000; }).toHyperLogLog();
+    low.merge(high);
+    EXPECT_DOUBLE_EQ(low.estimate(), from(ids).toHyperLogLog().estimate());
+
+    EXPECT_THROW(HyperLogLog(3), std::runtime_error);
+    EXPECT_THROW(low.merge(HyperLogLog(10)), std::runtime_error);
+}
+
+TEST_F(frame_dmlinq, Aggregation_Quantiles)
+{
+    using namespace dmlinq;
+
+    // 精确分位数：线性插值
+    EXPECT_DOUBLE_EQ(from(numbers).quantile(0.5), 2.0);
+    EXPECT_DOUBLE_EQ(from(numbers).quantile(0.0), -2.0);
+    EXPECT_DOUBLE_EQ(from(numbers).quantile(1.0), 5.0);
+    EXPECT_DOUBLE_EQ(from(numbers).quantile(0.1), -0.5);
+    auto score_of = [](const Player& p) { return p.score; };
+    EXPECT_DOUBLE_EQ(from(players).quantile(0.5, score_of), 77.5);
+    EXPECT_THROW(from(empty_numbers).quantile(0.5), std::runtime_error);
+    EXPECT_THROW(from(numbers).quantile(1.5), std::runtime_error);
+
+    std::vector<int> latencies;
+    for (int i = 0; i < 100000; ++i) { latencies.push_back((i * 7919) % 100000); }
+    auto exact = from(latencies).quantiles({ 0.99, 0.5, 0.9 });
+    ASSERT_EQ(exact.size(), 3u);
+    EXPECT_NEAR(exact[0], 98999.01, 1e-6);
+    EXPECT_NEAR(exact[1], 49999.5, 1e-6);
+    EXPECT_NEAR(exact[2], 89999.1, 1e-6);
+
+    // 近似分位数：KLL 草图，误差约 1.7/k
+    auto approx = from(latencies).quantilesApprox({ 0.5, 0.9, 0.99 });
+    EXPECT_NEAR(approx[0], 50000.0, 2000.0);
+    EXPECT_NEAR(approx[1], 90000.0, 2000.0);
+    EXPECT_NEAR(approx[2], 99000.0, 2000.0);
+    EXPECT_DOUBLE_EQ(from(latencies).quantileApprox(1.0), 99999.0);
+
+    auto sketch = from(latencies).where([](int v) { return v % 2 == 0; }).toKllSketch();
+    sketch.merge(from(latencies).where([](int v) { return v % 2 != 0; }).toKllSketch());
+    EXPECT_EQ(sketch.count(), 100000u);
+    EXPECT_NEAR(sketch.quantile(0.25), 25000.0, 2000.0);
+    EXPECT_THROW(sketch.merge(KllSketch(64)), std::runtime_error);
+}
+
+TEST_F(frame_dmlinq, Sampling_ReservoirFractionStratified)
+{
+    using namespace dmlinq;
+
+    std::vector<int> values(100000);
+    std::iota(values.begin(), values.end(), 0);
+
+    // 蓄水池抽样：恰好 n 行，保持输入顺序，同一种子结果相同
+    auto picked = from(values).sample(100, 7).toVector();
+    ASSERT_EQ(picked.size(), 100u);
+    EXPECT_TRUE(std::is_sorted(picked.begin(), picked.end()));
+    EXPECT_EQ(std::set<int>(picked.begin(), picked.end()).size(), 100u);
+    EXPECT_EQ(from(values).sample(100, 7).toVector(), picked);
+    EXPECT_NE(from(values).sample(100, 8).toVector(), picked);
+    EXPECT_EQ(from(numbers).sample(10).count(), numbers.size());
+    EXPECT_EQ(from(values).sample(0).count(), 0u);
+    // 均匀性：样本均值接近总体均值
+    double mean = from(values).sample(2000, 1).average();
+    EXPECT_NEAR(mean, 49999.5, 3000.0);
+
+    // 伯努利抽样：被跳过的行不会进入下游算子
+    size_t projected = 0;
+    auto sampled_avg = from(values).sampleFraction(0.01, 3).select([&projected](int v) { ++projected; return v; }).average();
+    EXPECT_NEAR(static_cast<double>(projected), 1000.0, 150.0);
+    EXPECT_NEAR(sampled_avg, 49999.5, 5000.0);
+    EXPECT_EQ(from(values).sampleFraction(0.0).count(), 0u);
+    EXPECT_EQ(from(values).sampleFraction(1.0).count(), values.size());
+    EXPECT_THROW((void)from(values).sampleFraction(1.5), std::runtime_error);
+
+    // 分层抽样：每个键最多 n 行
+    auto team_of = [](const Player& p) { return p.team; };
+    auto per_team = from(players).sampleBy(team_of, 2, 5).toVector();
+    ASSERT_EQ(per_team.size(), 4u);
+    auto is_eagle = [](const Player& p) { return p.team == "Eagles"; };
+    EXPECT_EQ(from(per_team).count(is_eagle), 2u);
+    auto by_decile = from(values).sampleBy([](int v) { return v / 10000; }, 10).toVector();
+    EXPECT_EQ(by_decile.size(), 100u);
+    EXPECT_TRUE(std::is_sorted(by_decile.begin(), by_decile.end()));
+
+    EXPECT_EQ(from(values).sampleFraction(0.5).explain().op, "SampleFraction");
+
+    // 生成器返回 nullopt 之后不会再被调用
+    int pulls_after_end = 0;
+    auto thousand = [&pulls_after_end, n = 0]() mutable -> std::optional<int> {
+        if (n == 1000) { ++pulls_after_end; return std::nullopt; }
+        return n++;
+    };
+    EXPECT_EQ(fromGenerator(thousand).sample(10, 3).toVector().size(), 10u);
+    EXPECT_EQ(pulls_after_end, 1);
+    pulls_after_end = 0;
+    auto fraction_rows = fromGenerator(thousand).sampleFraction(0.3, 3).toVector();
+    EXPECT_GT(fraction_rows.size(), 0u);
+    EXPECT_EQ(pulls_after_end, 1);
+
+    // 几何间隔在概率下溢为 0 时被截断，而不是转换无穷大
+    EXPECT_EQ(detail::geometricGap(0.5, 0.0), (std::numeric_limits<size_t>::max)());
+    EXPECT_EQ(detail::geometricGap(0.5, 0.5), 1u);
+}
+
+TEST_F(frame_dmlinq, Aggregation_FrequencyAndHistogram)
+{
+    using namespace dmlinq;
+
+    // countBy：按首次出现顺序输出 (键, 次数)
+    auto team_of = [](const Player& p) { return p.team; };
+    auto teams = from(players).countBy(team_of).toVector();
+    ASSERT_EQ(teams.size(), 2u);
+    EXPECT_EQ(teams[0], std::make_pair(std::string("Eagles"), size_t{ 3 }));
+    EXPECT_EQ(teams[1], std::make_pair(std::string("Bears"), size_t{ 3 }));
+
+    // topFrequent：次数降序，次数相同按首次出现顺序
+    std::vector<int> codes;
+    for (int i = 0; i < 1000; ++i) { codes.push_back(i % 10 < 5 ? 404 : i % 10 < 8 ? 500 : i % 10 == 8 ? 503 : i); }
+    auto code_of = [](int c) { return c; };
+    auto top = from(codes).topFrequent(code_of, 3);
+    ASSERT_EQ(top.size(), 3u);
+    EXPECT_EQ(top[0], std::make_pair(404, size_t{ 500 }));
+    EXPECT_EQ(top[1], std::make_pair(500, size_t{ 300 }));
+    EXPECT_EQ(top[2], std::make_pair(503, size_t{ 100 }));
+    EXPECT_EQ(from(numbers).topFrequent(code_of, 10).size(), 5u);
+    EXPECT_EQ(from(numbers).topFrequent(code_of, 1)[0], std::make_pair(1, size_t{ 2 }));
+
+    // Space-Saving：计数器远少于不同键的个数时仍能找到高频键，计数是上界
+    std::vector<int> stream;
+    for (int i = 0; i < 100000; ++i) { stream.push_back(i % 4 == 0 ? 7 : i % 8 == 1 ? 11 : 1000 + i); }
+    auto approx = from(stream).topFrequentApprox(code_of, 2, 64);
+    ASSERT_EQ(approx.size(), 2u);
+    EXPECT_EQ(approx[0].first, 7);
+    EXPECT_EQ(approx[1].first, 11);
+    EXPECT_GE(approx[0].second, 25000u);
+    EXPECT_GE(approx[1].second, 12500u);
+    EXPECT_THROW(from(stream).topFrequentApprox(code_of, 10, 5), std::runtime_error);
+
+    // 直方图：等宽分箱，最大值落入最后一箱
+    auto score_of = [](const Player& p) { return p.score; };
+    auto hist = from(players).histogram(score_of, 4);
+    EXPECT_DOUBLE_EQ(hist.lo, 50.0);
+    EXPECT_DOUBLE_EQ(hist.hi, 90.0);
+    EXPECT_EQ(hist.counts, (std::vector<size_t>{ 2, 0, 1, 3 }));
+    auto fixed = from(numbers).histogram(code_of, 2, 0.0, 4.0);
+    EXPECT_EQ(fixed.counts, (std::vector<size_t>{ 2, 2 }));
+    EXPECT_EQ(fixed.underflow, 1u);
+    EXPECT_EQ(fixed.overflow, 1u);
+    std::vector<double> many(5000);
+    for (size_t i = 0; i < many.size(); ++i) { many[i] = static_cast<double>(i % 100); }
+    auto spread = from(many).histogram([](double v) { return v; }, 10, 0.0, 100.0);
+    EXPECT_EQ(spread.counts, std::vector<size_t>(10, 500));
+    EXPECT_EQ(from(empty_numbers).histogram(code_of, 3).counts, std::vector<size_t>(3, 0));
+    EXPECT_THROW(from(numbers).histogram(code_of, 0), std::runtime_error);
+}
+
+TEST_F(frame_dmlinq, Concurrency_SharedImmutableQuery)
+{
+    using namespace dmlinq;
+
+    // 派生查询不会修改基础查询
+    const auto base = from(players).where([](const Player& p) { return p.score >= 60; });
+    auto bears = base.where([](const Player& p) { return p.team == "Bears"; });
+    auto top = base.orderByDescending([](const Player& p) { return p.score; }).take(1);
+    EXPECT_EQ(base.count(), 4u);
+    EXPECT_EQ(bears.count(), 3u);
+    EXPECT_EQ(top.first().name, "David");
+    auto is_eagle = [](const Player& p) { return p.team == "Eagles"; };
+    EXPECT_EQ(base.first(is_eagle).name, "Bob");
+    EXPECT_EQ(base.count(), 4u);
+    EXPECT_EQ(base.toVector().size(), 4u);
+    EXPECT_EQ(base.toVector().size(), 4u);
+
+    // 多个线程并发执行同一个基础查询
+    std::vector<int> values(20000);
+    std::iota(values.begin(), values.end(), 0);
+    const auto shared = from(values).where([](int v) { return v % 2 == 0; });
+    std::vector<std::thread> workers;
+    std::atomic<int> mismatches{ 0 };
+    for (int t = 0; t < 8; ++t) {
+        workers.emplace_back([&, t]() {
+            for (int i = 0; i < 50; ++i) {
+                int threshold = t * 1000 + i;
+                auto above = shared.where([threshold](int v) { return v >= threshold; });
+                size_t expected = 10000 - static_cast<size_t>((threshold + 1) / 2);
+                if (above.count() != expected) { ++mismatches; }
+                if (std::move(above).take(3).toVector().size() != 3) { ++mismatches; }
+                if (shared.sum() != 99990000) { ++mismatches; }
+            }
+        });
+    }
+    for (auto& worker : workers) { worker.join(); }
+    EXPECT_EQ(mismatches, 0);
+    EXPECT_EQ(shared.count(), 10000u);
+
+    // 由共享基础查询派生的临时查询不会搬走基础查询的数据源
+    std::vector<int> owned(1000);
+    std::iota(owned.begin(), owned.end(), 0);
+    auto twice = [](int v) { return v * 2; };
+    auto is_small = [](int v) { return v < 100; };
+    const auto owning_base = from(std::move(owned)).select(twice);
+    EXPECT_EQ(owning_base.where(is_small).toVector().size(), 50u);
+    EXPECT_EQ(owning_base.toVector().size(), 1000u);
+    std::vector<std::thread> derivers;
+    std::atomic<int> lost{ 0 };
+    for (int t = 0; t < 4; ++t) {
+        derivers.emplace_back([&]() {
+            for (int i = 0; i < 20; ++i) {
+                if (owning_base.where(is_small).toVector().size() != 50) { ++lost; }
+            }
+        });
+    }
+    for (auto& deriver : derivers) { deriver.join(); }
+    EXPECT_EQ(lost, 0);
+    EXPECT_EQ(owning_base.count(), 1000u);
+}
+
+TEST_F(frame_dmlinq, Limits_CancellationDeadlineBudgets)
+{
+    using namespace dmlinq;
+    std::vector<int> values(100000);
+    std::iota(values.begin(), values.end(), 0);
+    auto status_of = [](const auto& query) {
+        try { (void)query.toVector(); }
+        catch (const QueryCancelled& e) { return e.status(); }
+        return QueryStatus::Completed;
+    };
+
+    // 已取消的令牌
+    QueryLimits cancelled;
+    cancelled.cancellation = CancellationToken();
+    cancelled.cancellation->cancel();
+    auto cancelled_query = from(values).withLimits(cancelled).where([](int v) { return v % 2 == 0; });
+    EXPECT_EQ(status_of(cancelled_query), QueryStatus::Cancelled);
+
+    // 截止时间已过，排序中途停止
+    QueryLimits late;
+    late.deadline = std::chrono::steady_clock::now() - std::chrono::milliseconds(1);
+    auto late_query = from(values).withLimits(late).orderByDescending([](int v) { return v; });
+    EXPECT_EQ(status_of(late_query), QueryStatus::DeadlineExceeded);
+
+    // 扫描行数上限
+    QueryLimits rows;
+    rows.max_rows_scanned = 1000;
+    auto row_query = from(values).withLimits(rows).where([](int v) { return v % 2 == 0; });
+    EXPECT_EQ(status_of(row_query), QueryStatus::RowLimitExceeded);
+    EXPECT_EQ(status_of(row_query.take(10)), QueryStatus::Completed);
+
+    // 部分结果：流式查询返回已产出的前缀
+    auto partial = row_query.tryToVector();
+    EXPECT_FALSE(partial.complete());
+    EXPECT_EQ(partial.status, QueryStatus::RowLimitExceeded);
+    EXPECT_EQ(partial.value.size(), 500u);
+    EXPECT_EQ(partial.value.back(), 998);
+
+    // 分配字节上限
+    QueryLimits bytes;
+    bytes.max_bytes_allocated = 4096;
+    auto negate = [](int v) { return -v; };
+    auto byte_query = from(values).withLimits(bytes).orderBy(negate);
+    EXPECT_EQ(status_of(byte_query), QueryStatus::ByteLimitExceeded);
+    bytes.max_bytes_allocated = 16 * values.size();
+    EXPECT_EQ(from(values).withLimits(bytes).orderBy(negate).first(), 99999);
+
+    // 受字节上限约束的异步查询中途放弃：游标的缓冲区必须在 guard 之前归还
+    QueryLimits async_bytes;
+    async_bytes.max_bytes_allocated = 1 << 20;
+    {
+        auto abandoned = from(values).withLimits(async_bytes).orderBy(negate).toVectorAsync(10);
+        EXPECT_FALSE(abandoned.step());
+        size_t visited = 0;
+        auto abandoned_each = from(values).withLimits(async_bytes).orderBy(negate).forEachAsync([&visited](int) { ++visited; }, 10);
+        EXPECT_FALSE(abandoned_each.step());
+        EXPECT_EQ(visited, 10u);
+    }
+
+    // 未触发限制时结果完整
+    QueryLimits loose;
+    loose.cancellation = CancellationToken();
+    loose.deadline = std::chrono::steady_clock::now() + std::chrono::hours(1);
+    loose.max_rows_scanned = values.size();
+    auto loose_query = from(values).withLimits(loose).where([](int v) { return v % 2 == 0; });
+    EXPECT_EQ(loose_query.toVector().size(), 50000u);
+    auto full = loose_query.tryToVector();
+    EXPECT_TRUE(full.complete());
+    EXPECT_EQ(full.value.size(), 50000u);
+
+    // 无穷生成器在行数上限处停止
+    QueryLimits endless_rows;
+    endless_rows.max_rows_scanned = 5000;
+    auto endless = fromGenerator([n = 0]() mutable { return std::optional<int>(n++); }).withLimits(endless_rows);
+    EXPECT_EQ(status_of(endless), QueryStatus::RowLimitExceeded);
+
+    // 执行中途取消：溢出排序与并行扫描都会检查
+    QueryLimits midway;
+    midway.cancellation = CancellationToken();
+    std::atomic<int> seen{ 0 };
+    auto cancel_after = [&seen, token = *midway.cancellation](int) {
+        if (++seen == 5000) { token.cancel(); }
+        return true;
+    };
+    auto spilled = from(values).withLimits(midway).where(cancel_after).orderBy(negate).withMemoryLimit(4096);
+    EXPECT_EQ(status_of(spilled), QueryStatus::Cancelled);
+    EXPECT_LT(seen.load(), 7000);
+
+    std::vector<int> many(1000000);
+    std::iota(many.begin(), many.end(), 0);
+    QueryLimits parallel_limits;
+    parallel_limits.cancellation = CancellationToken();
+    seen = 0;
+    auto cancel_parallel = [&seen, token = *parallel_limits.cancellation](int) {
+        if (++seen == 5000) { token.cancel(); }
+        return true;
+    };
+    std::optional<QueryStatus> parallel_status;
+    try { (void)from(many).withLimits(parallel_limits).withParallelism(4).where(cancel_parallel).count(); }
+    catch (const QueryCancelled& e) { parallel_status = e.status(); }
+    EXPECT_EQ(parallel_status, QueryStatus::Cancelled);
+    parallel_limits.cancellation.reset();
+    parallel_limits.max_rows_scanned = 1000;
+    std::optional<QueryStatus> parallel_rows;
+    try { (void)from(many).withLimits(parallel_limits).withParallelism(4).count(); }
+    catch (const QueryCancelled& e) { parallel_rows = e.status(); }
+    EXPECT_EQ(parallel_rows, QueryStatus::RowLimitExceeded);
+}
+
+TEST_F(frame_dmlinq, Parallel_MorselAggregation)
+{
+    using namespace dmlinq;
+    std::vector<int> values(1000000);
+    std::iota(values.begin(), values.end(), 0);
+    auto serial = from(values);
+    auto parallel = from(values).withParallelism(4);
+    EXPECT_GE(detail::NumaTopology::nodeCount(), 1u);
+
+    // 并行聚合与串行结果一致
+    auto is_even = [](int v) { return v % 2 == 0; };
+    auto widen = [](int v) { return static_cast<int64_t>(v); };
+    EXPECT_EQ(parallel.count(), values.size());
+    EXPECT_EQ(parallel.count(is_even), 500000u);
+    EXPECT_EQ(parallel.sum(widen), serial.sum(widen));
+    EXPECT_DOUBLE_EQ(parallel.average(), serial.average());
+    EXPECT_EQ(parallel.where(is_even).sum(widen), serial.where(is_even).sum(widen));
+
+    // 自定义折叠与合并
+    auto fold_max = [](int best, int v) { return (std::max)(best, v); };
+    EXPECT_EQ(parallel.aggregate(-1, fold_max, fold_max), 999999);
+    EXPECT_EQ(serial.aggregate(-1, fold_max, fold_max), 999999);
+
+    // 每个线程一份局部草图，合并后与串行结果相同
+    auto bucket = [](int v) { return v % 5000; };
+    EXPECT_DOUBLE_EQ(parallel.toHyperLogLog(bucket).estimate(), serial.toHyperLogLog(bucket).estimate());
+    EXPECT_EQ(parallel.toKllSketch().count(), values.size());
+    EXPECT_NEAR(parallel.quantileApprox(0.5), 500000.0, 20000.0);
+
+    // 排序或截断的查询退回串行执行
+    auto descending = [](int v) { return -v; };
+    EXPECT_EQ(parallel.orderBy(descending).take(3).sum(), 999999 + 999998 + 999997);
+    EXPECT_EQ(parallel.take(10).count(), 10u);
+}